@@ -0,0 +1,783 @@
+// Headless benchmark. Renders a fixed set of deterministic scenes offscreen at
+// several resolutions and reports ms/frame, triangles/s and shaded pixels/s.
+// Needs nothing but the renderer, so it builds anywhere the renderer does.
+//
+//   benchmark [--frames N] [--threads N] [--sizes WxH,WxH,...] [--scenes a,b,...]
+//             [--ppm DIR] [--golden DIR] [--baseline FILE] [--save-baseline FILE]
+//             [--threshold FRACTION] [--paths generic,specialised] [--samples 1,4]
+//             [--layouts linear,tiled]
+//
+// Every scene is drawn through the function pointer shaders, and all but
+// filtered also through Pipeline::draw with the same shaders as functors,
+// reported as <scene>-spec. Scenes are also drawn 4x multisampled, reported
+// as <scene>-4x, on the generic path only. props and instanced draw the same
+// cubes, with a draw per cube and with one instanced draw. Every run is
+// repeated with tiled colour and depth buffers, reported with -tiled after
+// the name, which shows what the layout saves in cache and TLB misses at
+// each size. Specialised and tiled runs fail unless their last frame is
+// identical to that of the generic linear run of the same scene, size and
+// sample count, when that run is selected too.
+// --ppm writes the last frame of every run as DIR/<name>_<W>x<H>.ppm, named
+// as reported, and --golden compares it against DIR/<scene>_<W>x<H>.ppm,
+// with -4x after the scene name when multisampled, the same golden serving
+// every path and layout. --baseline
+// reads "<scene> <W> <H> <ms>" lines written by --save-baseline and fails any
+// run slower than the baseline by more than the threshold. Any run whose
+// timed frames allocate fails too, as frames after the first few must not.
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+#include "Renderer.hpp"
+#include "Pipeline.hpp"
+#include "Texture.hpp"
+
+struct Mesh {
+    std::vector< glm::vec3 > positions;
+    std::vector< glm::vec2 > texcoords;
+    std::vector< int32_t > indices;
+    PrimitiveTopology topology;
+};
+
+struct Scene {
+    char const* name;
+    // Fills mesh and adds one modelview per time the mesh is drawn
+    void (*build)(size_t width, size_t height, Mesh& mesh, std::vector< glm::mat4x4 >& modelviews);
+    // Samples a mip mapped Texture with trilinear filtering rather than
+    // reading the raw texels
+    bool filtered;
+    // Drawn like a transparent overlay: blended into what is already there,
+    // a quarter of each layer's colour at a time, without writing depth
+    bool blended;
+    // Drawn with one instanced draw, the modelviews being a per-instance
+    // attribute, rather than a draw per modelview
+    bool instanced;
+};
+
+struct Result {
+    std::string scene;
+    size_t width, height;
+    double ms;
+    double trianglesPerSecond;
+    double pixelsPerSecond;
+    size_t allocations;
+    PipelineStats stats;
+};
+
+enum : int
+{
+    TEXTURE_SIZE = 64,
+    WARMUP_FRAMES = 2
+};
+
+// Every operator new in the process, the renderer's included. Neither
+// replacement is inlined, so the compiler never pairs the free below with
+// an allocation it saw made by new.
+std::atomic< size_t > allocationCount(0);
+
+__attribute__((noinline))
+void* operator new(size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline))
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+uint8_t texture[TEXTURE_SIZE * TEXTURE_SIZE * 3];
+Texture* filteredTexture = nullptr;
+
+void create_texture() {
+    for (int y = 0; y < TEXTURE_SIZE; ++y) {
+        for (int x = 0; x < TEXTURE_SIZE; ++x) {
+            uint8_t* texel = &texture[((y * TEXTURE_SIZE) + x) * 3];
+            bool check = ((x / 8) + (y / 8)) % 2 == 0;
+            texel[0] = check ? 255 : uint8_t(x * 4);
+            texel[1] = check ? 255 : uint8_t(y * 4);
+            texel[2] = check ? 255 : 64;
+        }
+    }
+
+    filteredTexture = new Texture(TEXTURE_SIZE, TEXTURE_SIZE, 3, texture);
+}
+
+void transform_batch(glm::mat4x4 const& mvp, size_t const* vindices, size_t count, VertexArray* attributes, VertexStreams const& output) {
+    for (size_t j = 0; j < count; ++j) {
+        auto& position = *reinterpret_cast< glm::vec3* >(attributes[0].index(vindices[j]));
+        auto& uv       = *reinterpret_cast< glm::vec2* >(attributes[1].index(vindices[j]));
+        glm::vec4 clip = mvp * glm::vec4(position, 1.0f);
+        for (int c = 0; c < 4; ++c) {
+            output.position_stream(c)[j] = clip[c];
+        }
+
+        output.varying_stream(0)[j] = uv.x;
+        output.varying_stream(1)[j] = uv.y;
+    }
+}
+
+// Transforms position attribute 0 by uniforms[1] * uniforms[0] and passes
+// texcoord attribute 1 through.
+void vsh_func(size_t const* vindices, size_t count, VertexArray* attributes, std::vector< ShaderVariable > const& uniforms, VertexStreams const& output) {
+    transform_batch(uniforms[1].m4 * uniforms[0].m4, vindices, count, attributes, output);
+}
+
+// vsh_func with the modelview read from per-instance attribute 2, once per
+// batch as a batch never spans instances
+void instanced_vsh(size_t const* vindices, size_t count, VertexArray* attributes, std::vector< ShaderVariable > const& uniforms, VertexStreams const& output) {
+    transform_batch(uniforms[1].m4 * *reinterpret_cast< glm::mat4x4* >(attributes[2].index(0)), vindices, count, attributes, output);
+}
+
+inline glm::vec4 texel_color(glm::vec2 const& uv) {
+    int s = int(std::floor(uv.x * TEXTURE_SIZE)) & (TEXTURE_SIZE - 1);
+    int t = int(std::floor(uv.y * TEXTURE_SIZE)) & (TEXTURE_SIZE - 1);
+    uint8_t const* texel = &texture[((t * TEXTURE_SIZE) + s) * 3];
+    return glm::vec4(texel[0] / 255.0f, texel[1] / 255.0f, texel[2] / 255.0f, 1.0f);
+}
+
+glm::vec4 fsh_func(ShaderVariable* varyings, std::vector< ShaderVariable > const& uniforms) {
+    return texel_color(varyings[0].v2);
+}
+
+// vsh_func and fsh_func as functors for Pipeline::draw
+struct TexturedVaryings {
+    glm::vec2 uv;
+};
+
+struct TexturedVertexShader {
+    glm::vec4 operator()(size_t vindex, VertexArray* attributes, TexturedVaryings& out) const {
+        auto& position = *reinterpret_cast< glm::vec3* >(attributes[0].index(vindex));
+        out.uv = *reinterpret_cast< glm::vec2* >(attributes[1].index(vindex));
+        return mvp * glm::vec4(position, 1.0f);
+    }
+
+    glm::mat4x4 mvp;
+};
+
+// TexturedVertexShader for instanced draws, which picks the transform by
+// instance
+struct InstancedVertexShader {
+    glm::vec4 operator()(size_t vindex, size_t instance, VertexArray* attributes, TexturedVaryings& out) const {
+        auto& position = *reinterpret_cast< glm::vec3* >(attributes[0].index(vindex));
+        out.uv = *reinterpret_cast< glm::vec2* >(attributes[1].index(vindex));
+        return mvps[instance] * glm::vec4(position, 1.0f);
+    }
+
+    glm::mat4x4 const* mvps;
+};
+
+struct TexturedFragmentShader {
+    glm::vec4 operator()(TexturedVaryings const& in) const {
+        return texel_color(in.uv);
+    }
+};
+
+// Derivatives are on, so varyings[1] and varyings[2] are the uv derivatives
+glm::vec4 filtered_fsh(ShaderVariable* varyings, std::vector< ShaderVariable > const& uniforms) {
+    static Sampler const sampler(TextureFilter::Trilinear, TextureWrap::Repeat);
+    return filteredTexture->sample(sampler, varyings[0].v2, varyings[1].v2, varyings[2].v2);
+}
+
+glm::mat4x4 projection(size_t width, size_t height) {
+    return glm::perspective(60.0f, float(width) / float(height), 0.1f, 100.0f);
+}
+
+void add_quad(Mesh& mesh, glm::vec3 const& origin, glm::vec3 const& du, glm::vec3 const& dv, float uvScale) {
+    int32_t base = int32_t(mesh.positions.size());
+    mesh.positions.push_back(origin);
+    mesh.positions.push_back(origin + du);
+    mesh.positions.push_back(origin + dv);
+    mesh.positions.push_back(origin + du + dv);
+    mesh.texcoords.push_back(glm::vec2(0.0f, 0.0f));
+    mesh.texcoords.push_back(glm::vec2(uvScale, 0.0f));
+    mesh.texcoords.push_back(glm::vec2(0.0f, uvScale));
+    mesh.texcoords.push_back(glm::vec2(uvScale, uvScale));
+    int32_t quad[] = { base, base + 1, base + 2, base + 1, base + 3, base + 2 };
+    mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+}
+
+// The quad from main.cpp
+void build_quad(size_t width, size_t height, Mesh& mesh, std::vector< glm::mat4x4 >& modelviews) {
+    mesh.topology = PrimitiveTopology::TriangleList;
+    add_quad(mesh, glm::vec3(-1.0f, -1.0f, 0.0f), glm::vec3(2.0f, 0.0f, 0.0f), glm::vec3(0.0f, 2.0f, 0.0f), 1.0f);
+    modelviews.push_back(glm::translate(glm::mat4x4(), glm::vec3(0.0f, 0.0f, -3.5f)));
+}
+
+// The cylinder from main.cpp, tilted so both faces show
+void build_cylinder(size_t width, size_t height, Mesh& mesh, std::vector< glm::mat4x4 >& modelviews) {
+    mesh.topology = PrimitiveTopology::TriangleStrip;
+    float dangle = (2.0f * 3.14f) / 100.0f;
+    for (int i = 0; i <= 100; ++i) {
+        float angle = i * dangle;
+        glm::vec3 bottom(std::cos(angle), -0.5f, std::sin(angle));
+        float t = angle / (2.0f * 3.14f);
+        mesh.positions.push_back(bottom);
+        mesh.positions.push_back(glm::vec3(bottom.x, 0.5f, bottom.z));
+        mesh.texcoords.push_back(glm::vec2(t, 0.0f));
+        mesh.texcoords.push_back(glm::vec2(t, 1.0f));
+    }
+
+    glm::mat4x4 modelview = glm::translate(glm::mat4x4(), glm::vec3(0.0f, 0.0f, -3.5f)) * glm::rotate(glm::mat4x4(), 30.0f, glm::vec3(1.0f, 0.0f, 0.0f));
+    modelviews.push_back(modelview);
+}
+
+// A 256 x 256 segment UV sphere, about 130k triangles
+void build_mesh(size_t width, size_t height, Mesh& mesh, std::vector< glm::mat4x4 >& modelviews) {
+    enum { SEGMENTS = 256 };
+    mesh.topology = PrimitiveTopology::TriangleList;
+    for (int y = 0; y <= SEGMENTS; ++y) {
+        float theta = 3.14159265f * float(y) / SEGMENTS;
+        for (int x = 0; x <= SEGMENTS; ++x) {
+            float phi = 2.0f * 3.14159265f * float(x) / SEGMENTS;
+            mesh.positions.push_back(glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)));
+            mesh.texcoords.push_back(glm::vec2(4.0f * float(x) / SEGMENTS, 2.0f * float(y) / SEGMENTS));
+        }
+    }
+
+    for (int y = 0; y < SEGMENTS; ++y) {
+        for (int x = 0; x < SEGMENTS; ++x) {
+            int32_t a = (y * (SEGMENTS + 1)) + x, b = a + SEGMENTS + 1;
+            int32_t quad[] = { a, a + 1, b, a + 1, b + 1, b };
+            mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+        }
+    }
+
+    glm::mat4x4 modelview = glm::translate(glm::mat4x4(), glm::vec3(0.0f, 0.0f, -2.5f)) * glm::rotate(glm::mat4x4(), 20.0f, glm::vec3(1.0f, 1.0f, 0.0f));
+    modelviews.push_back(modelview);
+}
+
+// 16 screen covering quads drawn back to front, so every layer passes the
+// depth test
+void build_overdraw(size_t width, size_t height, Mesh& mesh, std::vector< glm::mat4x4 >& modelviews) {
+    enum { LAYERS = 16 };
+    mesh.topology = PrimitiveTopology::TriangleList;
+    add_quad(mesh, glm::vec3(-1.0f, -1.0f, 0.0f), glm::vec3(2.0f, 0.0f, 0.0f), glm::vec3(0.0f, 2.0f, 0.0f), 4.0f);
+    glm::mat4x4 fill = glm::scale(glm::mat4x4(), glm::vec3(float(width) / float(height), 1.0f, 1.0f));
+    for (int i = 0; i < LAYERS; ++i) {
+        float z = -1.0f - (0.25f * (LAYERS - i));
+        modelviews.push_back(glm::scale(glm::translate(glm::mat4x4(), glm::vec3(0.0f, 0.0f, z)), glm::vec3(-0.6f * z)) * fill);
+    }
+}
+
+// A screen filling grid of triangles about one pixel in area
+void build_tiny(size_t width, size_t height, Mesh& mesh, std::vector< glm::mat4x4 >& modelviews) {
+    size_t cellsX = width / 2, cellsY = height / 2;
+    mesh.topology = PrimitiveTopology::TriangleList;
+    for (size_t y = 0; y <= cellsY; ++y) {
+        for (size_t x = 0; x <= cellsX; ++x) {
+            glm::vec2 t(float(x) / cellsX, float(y) / cellsY);
+            mesh.positions.push_back(glm::vec3((2.0f * t.x) - 1.0f, (2.0f * t.y) - 1.0f, 0.0f));
+            mesh.texcoords.push_back(t);
+        }
+    }
+
+    for (size_t y = 0; y < cellsY; ++y) {
+        for (size_t x = 0; x < cellsX; ++x) {
+            int32_t a = int32_t((y * (cellsX + 1)) + x), b = a + int32_t(cellsX) + 1;
+            int32_t quad[] = { a, a + 1, b, a + 1, b + 1, b };
+            mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+        }
+    }
+
+    // Identity projection, so clip space is the grid itself
+    modelviews.push_back(glm::mat4x4());
+}
+
+// 10000 small cubes on a grid receding into the distance, each turned a
+// little further than the last
+void build_props(size_t width, size_t height, Mesh& mesh, std::vector< glm::mat4x4 >& modelviews) {
+    enum { ROWS = 100, COLUMNS = 100 };
+    mesh.topology = PrimitiveTopology::TriangleList;
+    glm::vec3 const corner(-0.5f, -0.5f, 0.5f);
+    glm::vec3 const x(1.0f, 0.0f, 0.0f), y(0.0f, 1.0f, 0.0f), z(0.0f, 0.0f, -1.0f);
+    add_quad(mesh, corner, x, y, 1.0f);
+    add_quad(mesh, corner + x, z, y, 1.0f);
+    add_quad(mesh, corner + x + z, -x, y, 1.0f);
+    add_quad(mesh, corner + z, -z, y, 1.0f);
+    add_quad(mesh, corner + y, x, z, 1.0f);
+    add_quad(mesh, corner + z, x, -z, 1.0f);
+    for (int row = 0; row < ROWS; ++row) {
+        for (int column = 0; column < COLUMNS; ++column) {
+            glm::vec3 position(0.3f * float(column - (COLUMNS / 2)), -1.5f, -3.0f - (0.3f * float(row)));
+            float angle = float(((row * COLUMNS) + column) % 360);
+            modelviews.push_back(glm::scale(glm::rotate(glm::translate(glm::mat4x4(), position), angle, glm::vec3(0.0f, 1.0f, 0.0f)), glm::vec3(0.15f)));
+        }
+    }
+}
+
+// A floor far larger than the guard band that crosses the near plane, and a
+// wall behind it, so every triangle is clipped
+void build_huge(size_t width, size_t height, Mesh& mesh, std::vector< glm::mat4x4 >& modelviews) {
+    mesh.topology = PrimitiveTopology::TriangleList;
+    add_quad(mesh, glm::vec3(-1000.0f, -1.0f, 5.0f), glm::vec3(2000.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, -55.0f), 250.0f);
+    add_quad(mesh, glm::vec3(-1000.0f, -1.0f, -50.0f), glm::vec3(2000.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1000.0f, 0.0f), 250.0f);
+    modelviews.push_back(glm::mat4x4());
+}
+
+Scene const scenes[] = {
+    { "quad", build_quad, false, false, false },
+    { "cylinder", build_cylinder, false, false, false },
+    { "mesh", build_mesh, false, false, false },
+    { "overdraw", build_overdraw, false, false, false },
+    { "blended", build_overdraw, false, true, false },
+    { "tiny", build_tiny, false, false, false },
+    { "huge", build_huge, false, false, false },
+    { "filtered", build_huge, true, false, false },
+    { "props", build_props, false, false, false },
+    { "instanced", build_props, false, false, true }
+};
+
+size_t triangle_count(Mesh const& mesh) {
+    if (!mesh.indices.empty()) {
+        return mesh.indices.size() / 3;
+    }
+
+    return (mesh.topology == PrimitiveTopology::TriangleStrip) ? mesh.positions.size() - 2 : mesh.positions.size() / 3;
+}
+
+template< typename State >
+void draw_specialised(Renderer& renderer, Mesh const& mesh, TexturedVertexShader const& vs) {
+    if (mesh.indices.empty()) {
+        Pipeline::draw< State >(renderer, vs, TexturedFragmentShader(), 0, mesh.positions.size());
+    }
+    else {
+        Pipeline::draw_indexed< State >(renderer, vs, TexturedFragmentShader(), 0, mesh.indices.size(), const_cast< int32_t* >(mesh.indices.data()));
+    }
+}
+
+// Instanced scenes are indexed lists that write depth. mvps are the
+// modelviews premultiplied by the projection, for the specialised path.
+void draw_instanced(Renderer& renderer, Mesh const& mesh, std::vector< glm::mat4x4 > const& modelviews, std::vector< glm::mat4x4 > const& mvps, bool specialised) {
+    int32_t* indices = const_cast< int32_t* >(mesh.indices.data());
+    if (specialised) {
+        InstancedVertexShader vs;
+        vs.mvps = mvps.data();
+        Pipeline::draw_indexed_instanced(renderer, vs, TexturedFragmentShader(), 0, mesh.indices.size(), indices, modelviews.size());
+    }
+    else {
+        renderer.set_attribute(2, 16, 0, const_cast< glm::mat4x4* >(modelviews.data()), 1);
+        renderer.draw_indexed_instanced(0, mesh.indices.size(), indices, modelviews.size());
+    }
+}
+
+void render_frame(Renderer& renderer, Mesh const& mesh, std::vector< glm::mat4x4 > const& modelviews, std::vector< glm::mat4x4 > const& mvps, Shader& vsh, bool specialised, bool instanced) {
+    renderer.clear(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), INFINITY);
+    renderer.set_attribute(0, 3, 0, const_cast< glm::vec3* >(mesh.positions.data()));
+    renderer.set_attribute(1, 2, 0, const_cast< glm::vec2* >(mesh.texcoords.data()));
+    renderer.set_primitive_topology(mesh.topology);
+    if (instanced) {
+        draw_instanced(renderer, mesh, modelviews, mvps, specialised);
+        renderer.resolve();
+        return;
+    }
+
+    for (glm::mat4x4 const& modelview : modelviews) {
+        vsh.uniforms[0] = modelview;
+        if (specialised) {
+            // Specialised draws fix the depth state at compile time
+            TexturedVertexShader vs;
+            vs.mvp = vsh.uniforms[1].m4 * modelview;
+            if (renderer.depth_write()) {
+                draw_specialised< DrawState<> >(renderer, mesh, vs);
+            }
+            else {
+                draw_specialised< DrawState< DepthTest::LessEqual, false > >(renderer, mesh, vs);
+            }
+        }
+        else if (mesh.indices.empty()) {
+            renderer.draw(0, mesh.positions.size());
+        }
+        else {
+            renderer.draw_indexed(0, mesh.indices.size(), const_cast< int32_t* >(mesh.indices.data()));
+        }
+    }
+
+    renderer.resolve();
+}
+
+// Rows are written top down, the framebuffer stores them bottom up
+std::vector< uint8_t > framebuffer_image(Framebuffer const& framebuffer) {
+    size_t width = framebuffer.width(), height = framebuffer.height();
+    uint8_t const* pixels = static_cast< uint8_t const* >(framebuffer.pixels());
+    std::vector< uint8_t > image;
+    char header[64];
+    int headerSize = std::snprintf(header, sizeof(header), "P6\n%zu %zu\n255\n", width, height);
+    image.insert(image.end(), header, header + headerSize);
+    for (size_t y = height; y-- > 0;) {
+        for (size_t x = 0; x < width; ++x) {
+            uint8_t const* pixel = pixels + (((y * width) + x) * 4);
+            image.insert(image.end(), pixel, pixel + 3);
+        }
+    }
+
+    return image;
+}
+
+bool write_file(std::string const& path, std::vector< uint8_t > const& data) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    bool ok = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+    return (std::fclose(file) == 0) && ok;
+}
+
+bool read_file(std::string const& path, std::vector< uint8_t >& data) {
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    data.clear();
+    uint8_t buffer[4096];
+    size_t read;
+    while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.insert(data.end(), buffer, buffer + read);
+    }
+
+    std::fclose(file);
+    return true;
+}
+
+Result run_scene(Scene const& scene, bool specialised, int samples, FramebufferLayout layout, size_t width, size_t height, int frames, size_t numThreads, std::vector< uint8_t >& image) {
+    Mesh mesh;
+    std::vector< glm::mat4x4 > modelviews;
+    scene.build(width, height, mesh, modelviews);
+    size_t triangles = triangle_count(mesh) * modelviews.size();
+
+    Renderer renderer;
+    renderer.set_framebuffer(width, height, PixelFormat::RGBA8, layout);
+    renderer.set_sample_count(samples);
+    renderer.set_viewport(0, 0, width, height);
+    renderer.set_thread_count(numThreads);
+    renderer.set_cull_mode(CullMode::None);
+    if (scene.blended) {
+        BlendState blend;
+        blend.enabled = true;
+        blend.srcColor = BlendFactor::ConstantColor;
+        blend.dstColor = BlendFactor::OneMinusConstantColor;
+        blend.constant = glm::vec4(0.25f);
+        renderer.set_blend_state(blend);
+        renderer.set_depth_write(false);
+    }
+
+    Shader vsh(scene.instanced ? instanced_vsh : vsh_func, std::vector< int >(1, 2)), fsh(scene.filtered ? filtered_fsh : fsh_func);
+    fsh.derivatives = scene.filtered;
+    vsh.uniforms.push_back(glm::mat4x4());
+    vsh.uniforms.push_back((scene.build == build_tiny) ? glm::mat4x4() : projection(width, height));
+    renderer.set_vertex_shader(vsh);
+    renderer.set_fragment_shader(fsh);
+
+    std::vector< glm::mat4x4 > mvps;
+    for (glm::mat4x4 const& modelview : modelviews) {
+        mvps.push_back(vsh.uniforms[1].m4 * modelview);
+    }
+
+    for (int i = 0; i < WARMUP_FRAMES; ++i) {
+        render_frame(renderer, mesh, modelviews, mvps, vsh, specialised, scene.instanced);
+    }
+
+    // The median frame is far less sensitive to the odd preempted frame than
+    // the mean
+    renderer.reset_pipeline_stats();
+    std::vector< double > times;
+    times.reserve(frames);
+    size_t allocations = allocationCount.load();
+    for (int i = 0; i < frames; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        render_frame(renderer, mesh, modelviews, mvps, vsh, specialised, scene.instanced);
+        auto end = std::chrono::steady_clock::now();
+        times.push_back(std::chrono::duration< double, std::milli >(end - start).count());
+    }
+
+    allocations = allocationCount.load() - allocations;
+
+    std::sort(times.begin(), times.end());
+    double ms = times[times.size() / 2];
+    PipelineStats stats = renderer.pipeline_stats();
+    double fragments = double(stats.fragmentShaderInvocations) / frames;
+
+    image = framebuffer_image(renderer.framebuffer());
+    Result result;
+    result.scene = std::string(scene.name) + (specialised ? "-spec" : "") + ((samples > 1) ? "-" + std::to_string(samples) + "x" : "");
+    result.scene += (layout == FramebufferLayout::Tiled) ? "-tiled" : "";
+    result.width = width;
+    result.height = height;
+    result.ms = ms;
+    result.trianglesPerSecond = triangles * (1000.0 / ms);
+    result.pixelsPerSecond = fragments * (1000.0 / ms);
+    result.allocations = allocations;
+    result.stats = stats;
+    return result;
+}
+
+// Per frame pipeline counters and each stage's share of the timed cycles
+void print_stage_breakdown(PipelineStats const& stats, int frames) {
+    double total = double(stats.vertexCycles + stats.setupCycles + stats.rasterCycles + stats.shadeCycles);
+    total = std::max(total, 1.0);
+    std::printf("           %llu verts %llu tris (%llu culled %llu clipped) %llu tested %llu passed %llu shaded\n",
+        (unsigned long long)(stats.verticesShaded / frames), (unsigned long long)(stats.trianglesSubmitted / frames),
+        (unsigned long long)(stats.trianglesCulled / frames), (unsigned long long)(stats.trianglesClipped / frames),
+        (unsigned long long)(stats.pixelsTested / frames), (unsigned long long)(stats.depthPasses / frames),
+        (unsigned long long)(stats.fragmentShaderInvocations / frames));
+    std::printf("           vertex %.1f%% setup %.1f%% raster %.1f%% shade %.1f%%\n",
+        100.0 * stats.vertexCycles / total, 100.0 * stats.setupCycles / total, 100.0 * stats.rasterCycles / total, 100.0 * stats.shadeCycles / total);
+}
+
+std::vector< std::string > split(std::string const& list) {
+    std::vector< std::string > items;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = std::min(list.find(',', start), list.size());
+        if (end > start) {
+            items.push_back(list.substr(start, end - start));
+        }
+
+        start = end + 1;
+    }
+
+    return items;
+}
+
+std::string baseline_key(std::string const& scene, size_t width, size_t height) {
+    return scene + " " + std::to_string(width) + " " + std::to_string(height);
+}
+
+bool load_baseline(std::string const& path, std::map< std::string, double >& baseline) {
+    FILE* file = std::fopen(path.c_str(), "r");
+    if (file == nullptr) {
+        return false;
+    }
+
+    char scene[64];
+    size_t width, height;
+    double ms;
+    while (std::fscanf(file, "%63s %zu %zu %lf", scene, &width, &height, &ms) == 4) {
+        baseline[baseline_key(scene, width, height)] = ms;
+    }
+
+    std::fclose(file);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    int frames = 20;
+    size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+    double threshold = 0.1;
+    std::string sizeList = "320x240,640x480,1920x1080", sceneList;
+    std::string ppmDir, goldenDir, baselinePath, saveBaselinePath, pathList = "generic,specialised", sampleList = "1,4", layoutList = "linear,tiled";
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::fprintf(stderr, "unknown or incomplete option %s\n", arg.c_str());
+            return 2;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--frames") frames = std::max(1, std::atoi(value.c_str()));
+        else if (arg == "--threads") numThreads = std::max(1, std::atoi(value.c_str()));
+        else if (arg == "--sizes") sizeList = value;
+        else if (arg == "--scenes") sceneList = value;
+        else if (arg == "--ppm") ppmDir = value;
+        else if (arg == "--golden") goldenDir = value;
+        else if (arg == "--baseline") baselinePath = value;
+        else if (arg == "--save-baseline") saveBaselinePath = value;
+        else if (arg == "--threshold") threshold = std::atof(value.c_str());
+        else if (arg == "--paths") pathList = value;
+        else if (arg == "--samples") sampleList = value;
+        else if (arg == "--layouts") layoutList = value;
+        else {
+            std::fprintf(stderr, "unknown option %s\n", arg.c_str());
+            return 2;
+        }
+    }
+
+    std::vector< std::pair< size_t, size_t > > sizes;
+    for (std::string const& size : split(sizeList)) {
+        size_t width = 0, height = 0;
+        if (std::sscanf(size.c_str(), "%zux%zu", &width, &height) != 2 || width == 0 || height == 0) {
+            std::fprintf(stderr, "bad size %s\n", size.c_str());
+            return 2;
+        }
+
+        sizes.push_back(std::make_pair(width, height));
+    }
+
+    std::vector< Scene const* > selected;
+    std::vector< std::string > names = split(sceneList);
+    for (Scene const& scene : scenes) {
+        if (names.empty() || std::find(names.begin(), names.end(), scene.name) != names.end()) {
+            selected.push_back(&scene);
+        }
+    }
+
+    std::vector< bool > paths;
+    for (std::string const& path : split(pathList)) {
+        if (path != "generic" && path != "specialised") {
+            std::fprintf(stderr, "bad path %s\n", path.c_str());
+            return 2;
+        }
+
+        paths.push_back(path == "specialised");
+    }
+
+    // Generic first, so that specialised runs have a run to compare against
+    std::sort(paths.begin(), paths.end());
+
+    std::vector< int > sampleCounts;
+    for (std::string const& count : split(sampleList)) {
+        int samples = std::atoi(count.c_str());
+        if (samples != 1 && samples != MultisampleBuffer::SAMPLES) {
+            std::fprintf(stderr, "bad sample count %s\n", count.c_str());
+            return 2;
+        }
+
+        sampleCounts.push_back(samples);
+    }
+
+    std::vector< FramebufferLayout > layouts;
+    for (std::string const& layout : split(layoutList)) {
+        if (layout != "linear" && layout != "tiled") {
+            std::fprintf(stderr, "bad layout %s\n", layout.c_str());
+            return 2;
+        }
+
+        layouts.push_back((layout == "tiled") ? FramebufferLayout::Tiled : FramebufferLayout::Linear);
+    }
+
+    // Linear first, for the same reason
+    std::sort(layouts.begin(), layouts.end());
+
+    std::map< std::string, double > baseline;
+    if (!baselinePath.empty() && !load_baseline(baselinePath, baseline)) {
+        std::fprintf(stderr, "can't read baseline %s\n", baselinePath.c_str());
+        return 2;
+    }
+
+    char const* rasteriser = "default";
+#if JHSR_X86_SIMD
+    if (best_rasteriser() == avx2_rasteriser) {
+        rasteriser = "avx2";
+    }
+    else if (best_rasteriser() == sse2_rasteriser) {
+        rasteriser = "sse2";
+    }
+#endif
+
+    create_texture();
+    std::printf("%zu threads, %d frames, %s rasteriser\n", numThreads, frames, rasteriser);
+    std::printf("%-20s %11s %10s %12s %12s  %s\n", "scene", "size", "ms/frame", "Mtri/s", "Mpix/s", "");
+
+    int failures = 0;
+    std::vector< Result > results;
+    std::vector< uint8_t > image, golden, reference;
+    for (auto const& size : sizes) {
+        for (Scene const* scene : selected) {
+            for (int samples : sampleCounts) {
+                bool hasReference = false;
+                for (bool specialised : paths) {
+                    // Fragment shaders of specialised draws have no derivatives,
+                    // and their targets aren't multisampled
+                    if (specialised && (scene->filtered || samples > 1)) {
+                        continue;
+                    }
+
+                    for (FramebufferLayout layout : layouts) {
+                        Result result = run_scene(*scene, specialised, samples, layout, size.first, size.second, frames, numThreads, image);
+                        results.push_back(result);
+
+                        std::string status;
+                        if (!specialised && layout == FramebufferLayout::Linear) {
+                            reference = image;
+                            hasReference = true;
+                        }
+                        else if (hasReference && image != reference) {
+                            status += " [image differs from generic linear]";
+                            ++failures;
+                        }
+
+                        std::string sizeSuffix = "_" + std::to_string(result.width) + "x" + std::to_string(result.height) + ".ppm";
+                        if (!ppmDir.empty() && !write_file(ppmDir + "/" + result.scene + sizeSuffix, image)) {
+                            status += " [can't write image]";
+                            ++failures;
+                        }
+
+                        if (!goldenDir.empty()) {
+                            std::string goldenName = std::string(scene->name) + ((samples > 1) ? "-" + std::to_string(samples) + "x" : "") + sizeSuffix;
+                            if (!read_file(goldenDir + "/" + goldenName, golden)) {
+                                status += " [no golden image]";
+                                ++failures;
+                            }
+                            else if (golden != image) {
+                                status += " [image differs from golden]";
+                                ++failures;
+                            }
+                        }
+
+                        if (result.allocations != 0) {
+                            status += " [" + std::to_string(result.allocations) + " allocations]";
+                            ++failures;
+                        }
+
+                        auto previous = baseline.find(baseline_key(result.scene, result.width, result.height));
+                        if (previous != baseline.end()) {
+                            double change = (result.ms / previous->second) - 1.0;
+                            char text[64];
+                            std::snprintf(text, sizeof(text), " %+.1f%%", change * 100.0);
+                            status += text;
+                            if (change > threshold) {
+                                status += " [regressed]";
+                                ++failures;
+                            }
+                        }
+
+                        char sizeText[32];
+                        std::snprintf(sizeText, sizeof(sizeText), "%zux%zu", result.width, result.height);
+                        std::printf("%-20s %11s %10.3f %12.3f %12.3f %s\n", result.scene.c_str(), sizeText, result.ms,
+                            result.trianglesPerSecond * 1e-6, result.pixelsPerSecond * 1e-6, status.c_str());
+#ifdef JHSR_PIPELINE_STATS
+                        print_stage_breakdown(result.stats, frames);
+#endif
+                        std::fflush(stdout);
+                    }
+                }
+            }
+        }
+    }
+
+    if (!saveBaselinePath.empty()) {
+        FILE* file = std::fopen(saveBaselinePath.c_str(), "w");
+        if (file == nullptr) {
+            std::fprintf(stderr, "can't write baseline %s\n", saveBaselinePath.c_str());
+            return 2;
+        }
+
+        for (Result const& result : results) {
+            std::fprintf(file, "%s %zu %zu %.4f\n", result.scene.c_str(), result.width, result.height, result.ms);
+        }
+
+        std::fclose(file);
+    }
+
+    if (failures > 0) {
+        std::printf("%d failure%s\n", failures, (failures == 1) ? "" : "s");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,205 @@
+#ifndef JHSR_CLIPPER_HPP
+#define JHSR_CLIPPER_HPP
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+
+// Outcode bits of a clip space vertex. The first six are the planes
+// triangles are actually clipped against: near and far, and the guard band,
+// which lies GUARD_BAND pixels outside the viewport. Anything inside the
+// guard band can be rasterised directly and is scissored by the rasteriser.
+// The last four are the viewport edges, which are only used to reject
+// triangles that are wholly off screen.
+enum ClipCode : uint32_t
+{
+	CLIP_NEAR         = 1 << 0,
+	CLIP_FAR          = 1 << 1,
+	CLIP_GUARD_LEFT   = 1 << 2,
+	CLIP_GUARD_RIGHT  = 1 << 3,
+	CLIP_GUARD_BOTTOM = 1 << 4,
+	CLIP_GUARD_TOP    = 1 << 5,
+	CLIP_VIEW_LEFT    = 1 << 6,
+	CLIP_VIEW_RIGHT   = 1 << 7,
+	CLIP_VIEW_BOTTOM  = 1 << 8,
+	CLIP_VIEW_TOP     = 1 << 9,
+
+	CLIP_PLANES_MASK  = CLIP_NEAR | CLIP_FAR | CLIP_GUARD_LEFT | CLIP_GUARD_RIGHT | CLIP_GUARD_BOTTOM | CLIP_GUARD_TOP,
+	CLIP_REJECT_MASK  = CLIP_NEAR | CLIP_FAR | CLIP_VIEW_LEFT | CLIP_VIEW_RIGHT | CLIP_VIEW_BOTTOM | CLIP_VIEW_TOP
+};
+
+struct ClipStats
+{
+	uint64_t trianglesAccepted;
+	uint64_t trianglesRejected;
+	uint64_t trianglesClipped;
+	uint64_t trianglesCulled;
+};
+
+// Homogeneous clipping after Blinn: planes are tested as dot(plane, p) >= 0
+// in clip space, before the divide by w, so vertices behind the eye need no
+// special handling and varyings interpolate linearly along clipped edges.
+class Clipper
+{
+public:
+
+	enum : int
+	{
+		// Pixels the guard band extends past each viewport edge. Bounds the
+		// snapped coordinates, and so the edge deltas the rasterisers keep
+		// in 32-bit SIMD lanes.
+		GUARD_BAND = 1024,
+		NUM_PLANES = 10,
+		NUM_CLIP_PLANES = 6,
+		// Each plane adds at most two vertices to the pool and one to the polygon
+		MAX_VERTICES = 3 + (2 * NUM_CLIP_PLANES)
+	};
+
+	Clipper();
+
+	// Viewport width and height in pixels.
+	void set_viewport(float width, float height);
+
+	uint32_t clip_code(glm::vec4 const& p) const;
+
+	// Clips the triangle against the planes in mask, which should be the
+	// union of its vertices' clip codes. Each vertex's varyings are
+	// numComponents packed floats. Returns the number of vertices of the
+	// resulting convex polygon, which keeps the triangle's winding, or 0 when
+	// nothing is left.
+	int clip_triangle(glm::vec4 const* const* positions, float const* const* varyings, int numComponents, uint32_t mask);
+
+	glm::vec4 const& position(int i) const;
+
+	float const* varyings(int i) const;
+
+	// The triangle corner polygon vertex i came from, or -1 if clipping made it.
+	int corner(int i) const;
+
+private:
+
+	int intersect(int inside, int outside, float dinside, float doutside);
+
+	glm::vec4 _planes[NUM_PLANES];
+
+	int _numComponents;
+	int _poolSize;
+	glm::vec4 _positions[MAX_VERTICES];
+	float const* _varyingPointers[MAX_VERTICES];
+	int _corners[MAX_VERTICES];
+	std::vector< float > _varyings;
+
+	int _polygon[MAX_VERTICES];
+	int _count;
+};
+
+
+inline Clipper::Clipper()
+: _numComponents(0), _poolSize(0), _count(0) {
+	set_viewport(1.0f, 1.0f);
+}
+
+// The viewport maps x / w in [-1, 1] to the viewport, so the guard band
+// edges are x / w = +-(1 + GUARD_BAND / (width / 2)).
+inline void Clipper::set_viewport(float width, float height) {
+	float gx = 1.0f + (GUARD_BAND / (0.5f * width));
+	float gy = 1.0f + (GUARD_BAND / (0.5f * height));
+	_planes[0] = glm::vec4( 0.0f,  0.0f,  1.0f, 1.0f);
+	_planes[1] = glm::vec4( 0.0f,  0.0f, -1.0f, 1.0f);
+	_planes[2] = glm::vec4( 1.0f,  0.0f,  0.0f, gx);
+	_planes[3] = glm::vec4(-1.0f,  0.0f,  0.0f, gx);
+	_planes[4] = glm::vec4( 0.0f,  1.0f,  0.0f, gy);
+	_planes[5] = glm::vec4( 0.0f, -1.0f,  0.0f, gy);
+	_planes[6] = glm::vec4( 1.0f,  0.0f,  0.0f, 1.0f);
+	_planes[7] = glm::vec4(-1.0f,  0.0f,  0.0f, 1.0f);
+	_planes[8] = glm::vec4( 0.0f,  1.0f,  0.0f, 1.0f);
+	_planes[9] = glm::vec4( 0.0f, -1.0f,  0.0f, 1.0f);
+}
+
+inline uint32_t Clipper::clip_code(glm::vec4 const& p) const {
+	uint32_t code = 0;
+	for (int i = 0; i < NUM_PLANES; ++i) {
+		if (glm::dot(_planes[i], p) < 0.0f) {
+			code |= (1u << i);
+		}
+	}
+
+	return code;
+}
+
+// Sutherland-Hodgman against one plane at a time. Intersections are always
+// computed from the inside vertex towards the outside one, so an edge shared
+// by two triangles is cut at exactly the same point for both.
+inline int Clipper::clip_triangle(glm::vec4 const* const* positions, float const* const* varyings, int numComponents, uint32_t mask) {
+	_numComponents = numComponents;
+	_varyings.resize(MAX_VERTICES * numComponents);
+	for (int i = 0; i < 3; ++i) {
+		_positions[i] = *positions[i];
+		_varyingPointers[i] = varyings[i];
+		_corners[i] = i;
+		_polygon[i] = i;
+	}
+
+	_poolSize = 3;
+	_count = 3;
+	int input[MAX_VERTICES];
+	for (int p = 0; p < NUM_CLIP_PLANES && _count > 0; ++p) {
+		if ((mask & (1u << p)) == 0) {
+			continue;
+		}
+
+		int inputCount = _count;
+		std::copy(_polygon, _polygon + inputCount, input);
+		_count = 0;
+		for (int i = 0; i < inputCount; ++i) {
+			int a = input[i], b = input[(i + 1) % inputCount];
+			float da = glm::dot(_planes[p], _positions[a]);
+			float db = glm::dot(_planes[p], _positions[b]);
+			if (da >= 0.0f) {
+				_polygon[_count++] = a;
+				if (db < 0.0f) {
+					_polygon[_count++] = intersect(a, b, da, db);
+				}
+			}
+			else if (db >= 0.0f) {
+				_polygon[_count++] = intersect(b, a, db, da);
+			}
+		}
+	}
+
+	return (_count >= 3) ? _count : 0;
+}
+
+inline int Clipper::intersect(int inside, int outside, float dinside, float doutside) {
+	assert(_poolSize < MAX_VERTICES);
+	int v = _poolSize++;
+	float t = dinside / (dinside - doutside);
+	_positions[v] = _positions[inside] + ((_positions[outside] - _positions[inside]) * t);
+	_corners[v] = -1;
+
+	float* out = _varyings.data() + (v * _numComponents);
+	float const* a = _varyingPointers[inside];
+	float const* b = _varyingPointers[outside];
+	for (int k = 0; k < _numComponents; ++k) {
+		out[k] = a[k] + ((b[k] - a[k]) * t);
+	}
+
+	_varyingPointers[v] = out;
+	return v;
+}
+
+inline glm::vec4 const& Clipper::position(int i) const {
+	return _positions[_polygon[i]];
+}
+
+inline float const* Clipper::varyings(int i) const {
+	return _varyingPointers[_polygon[i]];
+}
+
+inline int Clipper::corner(int i) const {
+	return _corners[_polygon[i]];
+}
+
+#endif // JHSR_CLIPPER_HPP
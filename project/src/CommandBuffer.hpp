@@ -0,0 +1,164 @@
+#ifndef JHSR_COMMANDBUFFER_HPP
+#define JHSR_COMMANDBUFFER_HPP
+
+#include "Renderer.hpp"
+#include <glm/glm.hpp>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+// A recorded list of renderer calls, replayed in order by
+// Renderer::execute() or a RenderQueue. The calls mirror the renderer's own
+// setters, and everything they are given is snapshotted when recorded:
+// shaders are copied along with their uniforms, and attributes keep the
+// binding they had. The vertex and index data themselves are not copied and
+// must stay unchanged until the buffer has executed.
+//
+// A buffer starts from whatever state the renderer is in and leaves its state
+// set afterwards, except for shaders, which are the buffer's own copies and
+// are unbound again once it has executed.
+class CommandBuffer
+{
+	friend class Renderer;
+
+public:
+
+	void set_attribute(int index, int components, size_t stride, void* ptr, size_t stepRate = 0);
+
+	void set_vertex_shader(Shader const& vsh);
+
+	void set_fragment_shader(Shader const& fsh);
+
+	void set_viewport(size_t x, size_t y, size_t w, size_t h);
+
+	void set_depth_range(float near, float far);
+
+	void set_primitive_topology(PrimitiveTopology topology);
+
+	void set_polygon_winding(PolygonWinding winding);
+
+	void set_render_mode(RenderMode mode);
+
+	void set_cull_mode(CullMode mode);
+
+	void set_depth_test(DepthTest test);
+
+	void set_depth_write(bool enabled);
+
+	void set_blend_state(BlendState const& state);
+
+	// Clears the back buffer to color and the depth buffer to depth
+	void clear(glm::vec4 const& color, float depth);
+
+	void draw(size_t start, size_t num);
+
+	void draw_indexed(size_t start, size_t num, int32_t* indices);
+
+	void draw_instanced(size_t start, size_t num, size_t instances);
+
+	void draw_indexed_instanced(size_t start, size_t num, int32_t* indices, size_t instances);
+
+	// Makes the back buffer the presented image, see Renderer::present()
+	void present();
+
+	size_t size() const;
+
+	// Drops every recorded command so the buffer can be recorded again
+	void reset();
+
+private:
+
+	typedef std::function< void (Renderer& renderer) > Command;
+
+	std::vector< Command > _commands;
+};
+
+
+inline void CommandBuffer::set_attribute(int index, int components, size_t stride, void* ptr, size_t stepRate) {
+	assert(index >= 0 && index < Renderer::MAX_ATTRIBUTES);
+	assert(ptr != nullptr);
+	_commands.push_back([=] (Renderer& renderer) { renderer.set_attribute(index, components, stride, ptr, stepRate); });
+}
+
+inline void CommandBuffer::set_vertex_shader(Shader const& vsh) {
+	std::shared_ptr< Shader > shader = std::make_shared< Shader >(vsh);
+	_commands.push_back([shader] (Renderer& renderer) { renderer.set_vertex_shader(*shader); });
+}
+
+inline void CommandBuffer::set_fragment_shader(Shader const& fsh) {
+	std::shared_ptr< Shader > shader = std::make_shared< Shader >(fsh);
+	_commands.push_back([shader] (Renderer& renderer) { renderer.set_fragment_shader(*shader); });
+}
+
+inline void CommandBuffer::set_viewport(size_t x, size_t y, size_t w, size_t h) {
+	_commands.push_back([=] (Renderer& renderer) { renderer.set_viewport(x, y, w, h); });
+}
+
+inline void CommandBuffer::set_depth_range(float near, float far) {
+	_commands.push_back([=] (Renderer& renderer) { renderer.set_depth_range(near, far); });
+}
+
+inline void CommandBuffer::set_primitive_topology(PrimitiveTopology topology) {
+	_commands.push_back([=] (Renderer& renderer) { renderer.set_primitive_topology(topology); });
+}
+
+inline void CommandBuffer::set_polygon_winding(PolygonWinding winding) {
+	_commands.push_back([=] (Renderer& renderer) { renderer.set_polygon_winding(winding); });
+}
+
+inline void CommandBuffer::set_render_mode(RenderMode mode) {
+	_commands.push_back([=] (Renderer& renderer) { renderer.set_render_mode(mode); });
+}
+
+inline void CommandBuffer::set_cull_mode(CullMode mode) {
+	_commands.push_back([=] (Renderer& renderer) { renderer.set_cull_mode(mode); });
+}
+
+inline void CommandBuffer::set_depth_test(DepthTest test) {
+	_commands.push_back([=] (Renderer& renderer) { renderer.set_depth_test(test); });
+}
+
+inline void CommandBuffer::set_depth_write(bool enabled) {
+	_commands.push_back([=] (Renderer& renderer) { renderer.set_depth_write(enabled); });
+}
+
+inline void CommandBuffer::set_blend_state(BlendState const& state) {
+	_commands.push_back([=] (Renderer& renderer) { renderer.set_blend_state(state); });
+}
+
+inline void CommandBuffer::clear(glm::vec4 const& color, float depth) {
+	_commands.push_back([=] (Renderer& renderer) { renderer.clear(color, depth); });
+}
+
+inline void CommandBuffer::draw(size_t start, size_t num) {
+	_commands.push_back([=] (Renderer& renderer) { renderer.draw(start, num); });
+}
+
+inline void CommandBuffer::draw_indexed(size_t start, size_t num, int32_t* indices) {
+	assert(indices != nullptr);
+	_commands.push_back([=] (Renderer& renderer) { renderer.draw_indexed(start, num, indices); });
+}
+
+inline void CommandBuffer::draw_instanced(size_t start, size_t num, size_t instances) {
+	_commands.push_back([=] (Renderer& renderer) { renderer.draw_instanced(start, num, instances); });
+}
+
+inline void CommandBuffer::draw_indexed_instanced(size_t start, size_t num, int32_t* indices, size_t instances) {
+	assert(indices != nullptr);
+	_commands.push_back([=] (Renderer& renderer) { renderer.draw_indexed_instanced(start, num, indices, instances); });
+}
+
+inline void CommandBuffer::present() {
+	_commands.push_back([] (Renderer& renderer) { renderer.present(); });
+}
+
+inline size_t CommandBuffer::size() const {
+	return _commands.size();
+}
+
+inline void CommandBuffer::reset() {
+	_commands.clear();
+}
+
+#endif // JHSR_COMMANDBUFFER_HPP
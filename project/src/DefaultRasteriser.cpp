@@ -1,10 +1,14 @@
 #include "DefaultRasteriser.hpp"
+#include "TriangleSetup.hpp"
 #include "Renderer.hpp"
 #include <tuple>
 #include <array>
 #include <cmath>
 #include <glm/gtc/swizzle.hpp>
 #include "FixedPointMath.hpp"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 // Ax + By + Cz + D = 0, where (A, B, C) is normal to the tri-plane
 // -> z = -A/C*x - B/C*y - D
@@ -22,128 +26,319 @@ inline std::tuple< T, T, T > calculate_gradients(T const& u0, T const& u1, T con
     return std::make_tuple(dudx, dudy, cu);                        
 }
 
-#define CALC_DELTAS(u0, u1, u2, rp0, rp1, rp2, minx, miny) {                                                            \
-        decltype(u0) dvdx, dvdy, cv;                                                                                    \
-        std::tie(dvdx, dvdy, cv) = calculate_gradients(u0, u1, u2, rp0, rp1, rp2, minx, miny);                          \
-        interpolatedVaryings.push_back(cv);                                                                             \
-        xgradients.push_back(dvdx);                                                                                     \
-        ygradients.push_back(dvdy);                                                                                     \
-    }
-
-void default_rasteriser(Renderer* renderer, Shader const& fsh, TriangleData& triangle) {
-    enum { P = 4 };
-    glm::vec4& p0 = get_triangle_vert0(triangle);
-    glm::vec4& p1 = get_triangle_vert1(triangle);
-    glm::vec4& p2 = get_triangle_vert2(triangle);
-    glm::ivec2 ip0(iround(p0.x * fixed_base< P >()), iround(p0.y * fixed_base< P >()));
-    glm::ivec2 ip1(iround(p1.x * fixed_base< P >()), iround(p1.y * fixed_base< P >()));
-    glm::ivec2 ip2(iround(p2.x * fixed_base< P >()), iround(p2.y * fixed_base< P >()));
-    int minx = iround(std::max(0.0f, std::min(std::min(p0.x, p1.x), p2.x)));
-    int miny = iround(std::max(0.0f, std::min(std::min(p0.y, p1.y), p2.y)));
-    int maxx = iround(std::min(float(renderer->framebuffer().width() - 1),  std::max(std::max(p0.x, p1.x), p2.x)));
-    int maxy = iround(std::min(float(renderer->framebuffer().height() - 1), std::max(std::max(p0.y, p1.y), p2.y)));
-
-    // All derived from:
-    //  float edge01 = (dx01 * (y - p0.y)) - (dy01 * (x - p0.x));
-    //  float edge12 = (dx12 * (y - p1.y)) - (dy12 * (x - p1.x));
-    //  float edge20 = (dx20 * (y - p2.y)) - (dy20 * (x - p2.x));
-    int dx01 = (ip1.x - ip0.x);
-    int dx12 = (ip2.x - ip1.x);
-    int dx20 = (ip0.x - ip2.x);
-    int dy01 = (ip1.y - ip0.y);
-    int dy12 = (ip2.y - ip1.y);
-    int dy20 = (ip0.y - ip2.y);
-
-    int c01 = fixed_mult< P >(dx01, -ip0.y) + fixed_mult< P >(dy01, ip0.x);
-    int c12 = fixed_mult< P >(dx12, -ip1.y) + fixed_mult< P >(dy12, ip1.x);
-    int c20 = fixed_mult< P >(dx20, -ip2.y) + fixed_mult< P >(dy20, ip2.x);
-
-    // Correct for fill convention
-    if (dy01 < 0 || (dy01 == 0 && dx01 > 0)) c01 += 1;
-    if (dy12 < 0 || (dy12 == 0 && dx12 > 0)) c12 += 1;
-    if (dy20 < 0 || (dy20 == 0 && dx20 > 0)) c20 += 1;
-
-    int cy01 = fixed_mult< P >(dx01, (miny << P)) + fixed_mult< P >(dy01, -(minx << P)) + c01;
-    int cy12 = fixed_mult< P >(dx12, (miny << P)) + fixed_mult< P >(dy12, -(minx << P)) + c12;
-    int cy20 = fixed_mult< P >(dx20, (miny << P)) + fixed_mult< P >(dy20, -(minx << P)) + c20;
+// Two positions per SSE2 register: x and y of both are gathered with one
+// shuffle, scaled, and rounded by the conversion, which rounds to nearest
+// even like iround.
+void snap_vertices(glm::vec4 const* positions, size_t count, int subpixelBits, glm::ivec2* snapped) {
+    float scale = float(1 << subpixelBits);
+    size_t i = 0;
+#if defined(__SSE2__)
+    __m128 vscale = _mm_set1_ps(scale);
+    for (; i + 2 <= count; i += 2) {
+        __m128 xy = _mm_movelh_ps(_mm_loadu_ps(&positions[i].x), _mm_loadu_ps(&positions[i + 1].x));
+        _mm_storeu_si128(reinterpret_cast< __m128i* >(&snapped[i]), _mm_cvtps_epi32(_mm_mul_ps(xy, vscale)));
+    }
+#endif
+    for (; i < count; ++i) {
+        snapped[i] = glm::ivec2(iround(positions[i].x * scale), iround(positions[i].y * scale));
+    }
+}
 
-    // Calculate gradient values for z, 1/w, and all varyings
-    float dzdx, dzdy, cz;
-    float dwdx, dwdy, cw;
-    std::tie(dzdx, dzdy, cz) = calculate_gradients(p0.z, p1.z, p2.z, p0, p1, p2, minx, miny);
-    std::tie(dwdx, dwdy, cw) = calculate_gradients(p0.w, p1.w, p2.w, p0, p1, p2, minx, miny);
-
-    auto& varying0 = get_triangle_varying0(triangle);
-    auto& varying1 = get_triangle_varying1(triangle);
-    auto& varying2 = get_triangle_varying2(triangle);
-    VaryingData interpolatedVaryings;
-    VaryingData xgradients;
-    VaryingData ygradients;
-    interpolatedVaryings.reserve(varying0.size() - 1);
-    xgradients.reserve(varying0.size() - 1);
-    ygradients.reserve(varying0.size() - 1);
-    for (int i = 1; i < varying0.size(); ++i) {
-        ShaderVariable& sv0 = varying0[i];
-        ShaderVariable& sv1 = varying1[i];
-        ShaderVariable& sv2 = varying2[i];                                                                             
-        switch(sv0.size) {
-            case 1:  { CALC_DELTAS(sv0.f  * p0.w, sv1.f  * p1.w, sv2.f  * p2.w, p0, p1, p2, minx, miny); break; }
-            case 2:  { CALC_DELTAS(sv0.v2 * p0.w, sv1.v2 * p1.w, sv2.v2 * p2.w, p0, p1, p2, minx, miny); break; }
-            case 3:  { CALC_DELTAS(sv0.v3 * p0.w, sv1.v3 * p1.w, sv2.v3 * p2.w, p0, p1, p2, minx, miny); break; }
-            case 4:  { CALC_DELTAS(sv0.v4 * p0.w, sv1.v4 * p1.w, sv2.v4 * p2.w, p0, p1, p2, minx, miny); break; }
-            case 9:  { CALC_DELTAS(sv0.m3 * p0.w, sv1.m3 * p1.w, sv2.m3 * p2.w, p0, p1, p2, minx, miny); break; }
-            case 16: { CALC_DELTAS(sv0.m4 * p0.w, sv1.m4 * p1.w, sv2.m4 * p2.w, p0, p1, p2, minx, miny); break; }
-            default:     { assert(false); break; }
+// edge01 evaluated at p2, which is inside the triangle exactly when the
+// triangle has the covered winding.
+int64_t snapped_area(glm::ivec2 const& p0, glm::ivec2 const& p1, glm::ivec2 const& p2) {
+    return (int64_t(p1.x - p0.x) * (p2.y - p0.y)) - (int64_t(p1.y - p0.y) * (p2.x - p0.x));
+}
+
+// Edge a -> b in subpixel units is E(X, Y) = dx * (Y - a.y) - dy * (X - a.x),
+// and pixel centres sit on whole pixels, X = x << P and Y = y << P. So
+// E = ((dx * y - dy * x) << P) + c for the exact 64-bit constant c, and
+// E > 0 exactly when dx * y - dy * x + (((c - 1) >> P) + 1) > 0. Folding c
+// into pixel units that way is exact, so edges shared by two triangles
+// always give each pixel to exactly one of them, at any target size.
+static inline void setup_edge(glm::ivec2 const& a, glm::ivec2 const& b, int subpixelBits, int32_t& dx, int32_t& dy, int64_t& c) {
+    dx = b.x - a.x;
+    dy = b.y - a.y;
+    int64_t constant = (int64_t(dy) * a.x) - (int64_t(dx) * a.y);
+
+    // Fill convention: pixels exactly on a top or left edge are covered
+    if (dy < 0 || (dy == 0 && dx > 0)) constant += 1;
+
+    c = ((constant - 1) >> subpixelBits) + 1;
+}
+
+void setup_edges(TriangleData const& triangle, int subpixelBits, TriangleEdges& edges) {
+    setup_edge(triangle.snapped[0], triangle.snapped[1], subpixelBits, edges.dx01, edges.dy01, edges.c01);
+    setup_edge(triangle.snapped[1], triangle.snapped[2], subpixelBits, edges.dx12, edges.dy12, edges.c12);
+    setup_edge(triangle.snapped[2], triangle.snapped[0], subpixelBits, edges.dx20, edges.dy20, edges.c20);
+}
+
+// Moving the samples by an offset is moving the triangle by minus the
+// offset, and the sample offsets are whole subpixels at any supported
+// precision, so sample coverage is as exact as pixel coverage.
+void setup_sample_edges(TriangleData const& triangle, int subpixelBits, TriangleEdges* samples, TriangleEdges& outer, TriangleEdges& inner) {
+    static_assert(Renderer::MIN_SUBPIXEL_BITS >= 4, "sample offsets are in sixteenths of a pixel");
+    for (int s = 0; s < MultisampleBuffer::SAMPLES; ++s) {
+        TriangleData shifted;
+        glm::ivec2 offset = sample_offset(s) * (1 << (subpixelBits - 4));
+        for (int k = 0; k < 3; ++k) {
+            shifted.snapped[k] = triangle.snapped[k] - offset;
         }
+
+        setup_edges(shifted, subpixelBits, samples[s]);
     }
 
-    size_t bufferSize = interpolatedVaryings.size() * sizeof(ShaderVariable);
-    uint8_t varyingsBuffer[bufferSize];
-    ShaderVariable* varyings = reinterpret_cast< ShaderVariable* >(&varyingsBuffer[0]);
-    for (int y = miny; y <= maxy; y += 1) {
-        int cx01 = cy01;
-        int cx12 = cy12;
-        int cx20 = cy20;
-        float z  = cz;
-        float w  = cw;
-        std::memcpy(varyings, &interpolatedVaryings[0], bufferSize);
-        for (int x = minx; x <= maxx; x += 1) {
-            if (cx01 > 0 && cx12 > 0 && cx20 > 0) {
-                float currentDepth;
-                renderer->depth_buffer().get_pixel(x, y, &currentDepth);
-                if (z <= currentDepth) {
-                    float realw = 1.0f / w;
-                    for (int i = 0; i < interpolatedVaryings.size(); ++i) varyings[i] *= realw;
-                    glm::vec4 color = fsh.ffunc(varyings, fsh.uniforms);
-                    for (int i = 0; i < interpolatedVaryings.size(); ++i) varyings[i] *= w;
-                    color *= glm::vec4(255.0f);
-                    uint32_t pixel = (static_cast< uint32_t >(color[3]) << 24) | (static_cast< uint32_t >(color[2]) << 16) | (static_cast< uint32_t >(color[1]) << 8) | static_cast< uint32_t >(color[0]);  
-                    renderer->depth_buffer().set_pixel(x, y, &z);
-                    renderer->framebuffer().set_pixel(x, y, &pixel);
-                }
-            }
+    outer = inner = samples[0];
+    for (int s = 1; s < MultisampleBuffer::SAMPLES; ++s) {
+        outer.c01 = std::max(outer.c01, samples[s].c01);
+        outer.c12 = std::max(outer.c12, samples[s].c12);
+        outer.c20 = std::max(outer.c20, samples[s].c20);
+        inner.c01 = std::min(inner.c01, samples[s].c01);
+        inner.c12 = std::min(inner.c12, samples[s].c12);
+        inner.c20 = std::min(inner.c20, samples[s].c20);
+    }
+}
+
+bool setup_triangle(Renderer* renderer, TriangleData const& triangle, TileRect const& tile, TriangleSetup& setup, RasterStats& stats) {
+    JHSR_STATS(ScopedCycleTimer timer(stats.setupCycles);)
+    glm::vec4 const& p0 = get_triangle_vert0(triangle);
+    glm::vec4 const& p1 = get_triangle_vert1(triangle);
+    glm::vec4 const& p2 = get_triangle_vert2(triangle);
+
+    // Gradients are anchored to the whole triangle's bounds, and only the
+    // traversal is limited to the tile, so every pixel gets the same value
+    // no matter how the screen is split up.
+    TileRect& bounds = setup.bounds;
+    bounds = triangle_bounds(triangle, renderer->framebuffer().width(), renderer->framebuffer().height());
+    setup.minx = std::max(bounds.minx, tile.minx);
+    setup.miny = std::max(bounds.miny, tile.miny);
+    setup.maxx = std::min(bounds.maxx, tile.maxx);
+    setup.maxy = std::min(bounds.maxy, tile.maxy);
+    if (setup.minx > setup.maxx || setup.miny > setup.maxy) {
+        return false;
+    }
+
+    setup.multisampled = (renderer->sample_count() > 1);
+    if (setup.multisampled) {
+        setup_sample_edges(triangle, renderer->subpixel_bits(), setup.sampleEdges, setup.edges, setup.innerEdges);
+    }
+    else {
+        setup_edges(triangle, renderer->subpixel_bits(), setup.edges);
+    }
+
+    // Calculate gradient values for z, 1/w, and all varyings
+    std::tie(setup.dzdx, setup.dzdy, setup.cz) = calculate_gradients(p0.z, p1.z, p2.z, p0, p1, p2, bounds.minx, bounds.miny);
+    setup.sampleMinDz = 0.0f;
+    for (int s = 0; s < MultisampleBuffer::SAMPLES && setup.multisampled; ++s) {
+        glm::vec2 offset = glm::vec2(sample_offset(s)) * (1.0f / 16.0f);
+        setup.sampleDz[s] = (setup.dzdx * offset.x) + (setup.dzdy * offset.y);
+        setup.sampleMinDz = std::min(setup.sampleMinDz, setup.sampleDz[s]);
+    }
+
+    // Reject the whole triangle against the tile level of the Hi-Z buffer
+    // before doing any per-block work or varying setup. The ShadeEqual pass
+    // always tests for equality and never writes depth, and nothing is
+    // shaded when no channel would be written.
+    RenderMode pass = renderer->raster_pass();
+    BlendState const& blend = renderer->blend_state();
+    setup.depthTest = (pass == RenderMode::ShadeEqual) ? DepthTest::Equal : renderer->depth_test();
+    setup.writeDepth = (pass != RenderMode::ShadeEqual) && renderer->depth_write();
+    setup.shade = (pass != RenderMode::DepthOnly) && (blend.writeMask != 0);
+    setup.occlusionCull = depth_test_in_front(setup.depthTest);
+    setup.blend = &blend;
+    setup.overwriteColor = blend.overwrites();
+    setup.colorFormat = renderer->framebuffer().format();
+    setup.hiZ = &renderer->hiz_buffer();
+    setup.depthBuffer = &renderer->depth_buffer();
+    if (setup.occlusionCull && (min_depth(setup, setup.minx, setup.miny, setup.maxx, setup.maxy) > setup.hiZ->max_depth(setup.minx, setup.miny, setup.maxx, setup.maxy))) {
+        ++stats.trianglesOccluded;
+        return false;
+    }
+
+    std::tie(setup.dwdx, setup.dwdy, setup.cw) = calculate_gradients(p0.w, p1.w, p2.w, p0, p1, p2, bounds.minx, bounds.miny);
+
+    // Varyings are packed floats, so every size of varying takes the same
+    // loop, one component at a time. Setup storage is bounded by
+    // MAX_VARYING_COMPONENTS, so rasterising a triangle never allocates.
+    float const* varying0 = get_triangle_varying0(triangle);
+    float const* varying1 = get_triangle_varying1(triangle);
+    float const* varying2 = get_triangle_varying2(triangle);
+    int numComponents = setup.numComponents = triangle.numComponents;
+    assert(numComponents <= Renderer::MAX_VARYING_COMPONENTS);
+    setup.numVaryings = triangle.numVaryings;
+    setup.varyingSizes = triangle.varyingSizes;
+    for (int k = 0; k < numComponents; ++k) {
+        std::tie(setup.xgradients[k], setup.ygradients[k], setup.interpolatedVaryings[k]) =
+            calculate_gradients(varying0[k] * p0.w, varying1[k] * p1.w, varying2[k] * p2.w, p0, p1, p2, bounds.minx, bounds.miny);
+    }
+
+    for (int k = numComponents; k < numComponents + TriangleSetup::VARYING_PADDING; ++k) {
+        setup.interpolatedVaryings[k] = setup.xgradients[k] = setup.ygradients[k] = 0.0f;
+    }
+
+    return true;
+}
+
+#if defined(__SSE2__)
+// The lanes of z that pass test against depth, exactly as depth_test_passes
+// decides each
+static inline __m128 depth_test_lanes(DepthTest test, __m128 z, __m128 depth) {
+    switch (test) {
+        case DepthTest::Never:        return _mm_setzero_ps();
+        case DepthTest::Less:         return _mm_cmplt_ps(z, depth);
+        case DepthTest::Equal:        return _mm_cmpeq_ps(z, depth);
+        case DepthTest::LessEqual:    return _mm_cmple_ps(z, depth);
+        case DepthTest::Greater:      return _mm_cmpgt_ps(z, depth);
+        case DepthTest::NotEqual:     return _mm_cmpneq_ps(z, depth);
+        case DepthTest::GreaterEqual: return _mm_cmpge_ps(z, depth);
+        default:                      return _mm_castsi128_ps(_mm_set1_epi32(-1));
+    }
+}
+#endif
 
-            cx01 -= dy01;
-            cx12 -= dy12;
-            cx20 -= dy20;
-            z    += dzdx;
-            w    += dwdx;
-            for (int i = 0; i < interpolatedVaryings.size(); ++i) {
-                varyings[i] += xgradients[i];
+// Depth tests the samples of a pixel in mask, which sit at the pixel
+// centre's z plus their offsets, and writes the depth of the ones that pass
+// if the pass writes depth. Returns the samples that passed. The four
+// samples of a pixel are one SSE2 register, and both paths do the same
+// arithmetic.
+static inline int test_samples(TriangleSetup const& setup, float z, int mask, float* depth) {
+    static_assert(MultisampleBuffer::SAMPLES == 4, "a pixel's samples are tested as four lanes");
+#if defined(__SSE2__)
+    __m128 sampleZ = _mm_add_ps(_mm_set1_ps(z), _mm_loadu_ps(setup.sampleDz));
+    __m128 current = _mm_loadu_ps(depth);
+    int passed = _mm_movemask_ps(depth_test_lanes(setup.depthTest, sampleZ, current)) & mask;
+    if (passed != 0 && setup.writeDepth) {
+        __m128i bits = _mm_set_epi32(8, 4, 2, 1);
+        __m128 write = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(passed), bits), bits));
+        _mm_storeu_ps(depth, _mm_or_ps(_mm_and_ps(write, sampleZ), _mm_andnot_ps(write, current)));
+    }
+
+    return passed;
+#else
+    int passed = 0;
+    for (int s = 0; s < MultisampleBuffer::SAMPLES; ++s) {
+        float sampleZ = z + setup.sampleDz[s];
+        if ((mask & (1 << s)) && depth_test(setup, sampleZ, depth[s])) {
+            passed |= 1 << s;
+            if (setup.writeDepth) {
+                depth[s] = sampleZ;
             }
         }
+    }
+
+    return passed;
+#endif
+}
+
+// Coverage and depth are tested per sample, but each pixel with a sample
+// that passes is shaded once, at its centre, and the colour is written to
+// the samples that passed. Inside blocks whose samples are all covered skip
+// the edge tests. Elsewhere, a sample is covered when none of its three
+// edge values minus one is negative, which takes no branches to work out.
+static void rasterise_multisampled(Renderer* renderer, Shader const& fsh, TriangleSetup const& setup, RasterStats& stats) {
+    enum { SAMPLES = MultisampleBuffer::SAMPLES };
+    ShaderVariable varyings[Renderer::MAX_FRAGMENT_INPUTS];
+    prepare_fragment_inputs(fsh, setup, varyings);
+    TriangleEdges const& edges = setup.edges;
+    int64_t c01[SAMPLES], c12[SAMPLES], c20[SAMPLES];
+    for (int s = 0; s < SAMPLES; ++s) {
+        c01[s] = setup.sampleEdges[s].c01 - 1;
+        c12[s] = setup.sampleEdges[s].c12 - 1;
+        c20[s] = setup.sampleEdges[s].c20 - 1;
+    }
 
-        cy01 += dx01;
-        cy12 += dx12;
-        cy20 += dx20;
-        cz   += dzdy;
-        cw   += dwdy;
-        for (int i = 0; i < interpolatedVaryings.size(); ++i) {
-            interpolatedVaryings[i] += ygradients[i];
+    for (BlockIterator block(setup, stats); block.next(); ) {
+        bool covered = block.inside && (classify_block(setup.innerEdges, block.x0, block.y0, block.x1, block.y1) == BlockCoverage::Inside);
+        for (int y = block.y0; y <= block.y1; y += 1) {
+            float* depth = sample_depth_span(renderer, block.x0, y);
+            int64_t cx01 = edge_value(0, edges.dx01, edges.dy01, block.x0, y);
+            int64_t cx12 = edge_value(0, edges.dx12, edges.dy12, block.x0, y);
+            int64_t cx20 = edge_value(0, edges.dx20, edges.dy20, block.x0, y);
+            float fy = float(y - setup.bounds.miny);
+            float rowz = setup.cz + (setup.dzdy * fy);
+            float roww = setup.cw + (setup.dwdy * fy);
+            for (int x = block.x0; x <= block.x1; x += 1, depth += SAMPLES) {
+                int mask = MultisampleBuffer::ALL_SAMPLES;
+                if (!covered) {
+                    mask = 0;
+                    for (int s = 0; s < SAMPLES; ++s) {
+                        uint64_t negative = uint64_t((cx01 + c01[s]) | (cx12 + c12[s]) | (cx20 + c20[s])) >> 63;
+                        mask |= int(negative ^ 1) << s;
+                    }
+                }
+
+                cx01 -= edges.dy01;
+                cx12 -= edges.dy12;
+                cx20 -= edges.dy20;
+                if (mask == 0) {
+                    continue;
+                }
+
+                float fx = float(x - setup.bounds.minx);
+                float z = rowz + (setup.dzdx * fx);
+                int passed = test_samples(setup, z, mask, depth);
+                JHSR_STATS(stats.pixelsTested += __builtin_popcount(mask);)
+                JHSR_STATS(stats.depthFails += __builtin_popcount(mask & ~passed);)
+                if (passed == 0) {
+                    continue;
+                }
+
+                block.written = true;
+                if (setup.shade) {
+                    JHSR_STATS(ScopedCycleTimer timer(stats.shadeCycles);)
+                    float realw = 1.0f / (roww + (setup.dwdx * fx));
+                    write_samples(renderer, setup, x, y, passed, run_fragment_shader(fsh, setup, varyings, fx, fy, realw));
+                    ++stats.fragmentsShaded;
+                }
+            }
         }
     }
 }
 
+void default_rasteriser(Renderer* renderer, Shader const& fsh, TriangleData const& triangle, TileRect const& tile, RasterStats& stats) {
+    TriangleSetup setup;
+    if (!setup_triangle(renderer, triangle, tile, setup, stats)) {
+        return;
+    }
 
+    if (setup.multisampled) {
+        rasterise_multisampled(renderer, fsh, setup, stats);
+        return;
+    }
 
+    // z, 1/w and the varyings are evaluated directly from the anchor rather
+    // than accumulated along the scanline, and only for fragments that will
+    // actually be shaded.
+    ShaderVariable varyings[Renderer::MAX_FRAGMENT_INPUTS];
+    prepare_fragment_inputs(fsh, setup, varyings);
+    TriangleEdges const& edges = setup.edges;
+    for (BlockIterator block(setup, stats); block.next(); ) {
+        for (int y = block.y0; y <= block.y1; y += 1) {
+            float const* depth = depth_span(renderer, block.x0, y);
+            int64_t cx01 = edge_value(edges.c01, edges.dx01, edges.dy01, block.x0, y);
+            int64_t cx12 = edge_value(edges.c12, edges.dx12, edges.dy12, block.x0, y);
+            int64_t cx20 = edge_value(edges.c20, edges.dx20, edges.dy20, block.x0, y);
+            float fy = float(y - setup.bounds.miny);
+            float rowz = setup.cz + (setup.dzdy * fy);
+            float roww = setup.cw + (setup.dwdy * fy);
+            for (int x = block.x0; x <= block.x1; x += 1) {
+                if (block.inside || (cx01 > 0 && cx12 > 0 && cx20 > 0)) {
+                    float fx = float(x - setup.bounds.minx);
+                    float z = rowz + (setup.dzdx * fx);
+                    JHSR_STATS(++stats.pixelsTested;)
+                    if (depth_test(setup, z, depth[x - block.x0])) {
+                        float realw = setup.shade ? 1.0f / (roww + (setup.dwdx * fx)) : 0.0f;
+                        JHSR_STATS(ScopedCycleTimer timer(stats.shadeCycles);)
+                        shade_fragment(renderer, fsh, setup, varyings, x, y, fx, fy, z, realw, stats);
+                        block.written = true;
+                    }
+                    JHSR_STATS(else ++stats.depthFails;)
+                }
 
+                cx01 -= edges.dy01;
+                cx12 -= edges.dy12;
+                cx20 -= edges.dy20;
+            }
+        }
+    }
+}
@@ -2,20 +2,93 @@
 #define JHSR_DEFAULT_RASTERISER_HPP
 
 #include "Shader.hpp"
-#include <vector>
+#include "FixedPointMath.hpp"
+#include "PipelineStats.hpp"
 #include <tuple>
+#include <cstdint>
 #include <glm/glm.hpp>
 
+// Inclusive pixel rectangle. The rasteriser only touches pixels inside the
+// rect it is given, which is what lets tiles be rasterised in parallel.
+struct TileRect
+{
+	int minx, miny, maxx, maxy;
+};
+
+// Counters a rasteriser accumulates while it runs. Each rasterising thread
+// has its own, so they can be bumped without synchronisation.
+struct RasterStats
+{
+	uint64_t blocksOutside;
+	uint64_t blocksPartial;
+	uint64_t blocksInside;
+	uint64_t tilesRejected;
+	uint64_t blocksOccluded;
+	uint64_t trianglesOccluded;
+	uint64_t fragmentsShaded;
+
+	// Only counted with JHSR_PIPELINE_STATS. Rasteriser cycles span whole
+	// rasteriser calls, setup and shading included.
+	uint64_t pixelsTested;
+	uint64_t depthFails;
+	uint64_t setupCycles;
+	uint64_t rasteriserCycles;
+	uint64_t shadeCycles;
+};
+
 class Renderer;
-typedef std::tuple< glm::vec4, glm::vec4, glm::vec4, VaryingData, VaryingData, VaryingData > TriangleData;
-typedef void (*RasteriserFunc) (Renderer* renderer, Shader const& fsh, TriangleData& triangle);
-inline glm::vec4& 	get_triangle_vert0(TriangleData& vd) 	{ return std::get< 0 >(vd); }
-inline glm::vec4& 	get_triangle_vert1(TriangleData& vd) 	{ return std::get< 1 >(vd); }
-inline glm::vec4& 	get_triangle_vert2(TriangleData& vd) 	{ return std::get< 2 >(vd); }
-inline VaryingData& get_triangle_varying0(TriangleData& vd) { return std::get< 3 >(vd); }
-inline VaryingData& get_triangle_varying1(TriangleData& vd) { return std::get< 4 >(vd); }
-inline VaryingData& get_triangle_varying2(TriangleData& vd) { return std::get< 5 >(vd); }
-
-void default_rasteriser(Renderer* renderer, Shader const& fsh, TriangleData& triangle);
-
-#endif // JHSR_DEFAULT_RASTERISER_HPP
\ No newline at end of file
+
+// Window space vertices plus each vertex's varyings. The varyings live in the
+// renderer's post-transform storage and stay valid until the draw completes,
+// so triangles can be assembled and binned without allocating. Each vertex's
+// are numComponents packed floats, varying i taking the next varyingSizes[i]
+// of them. snapped holds x and y on the renderer's subpixel grid, which is
+// what coverage uses.
+struct TriangleData
+{
+	glm::vec4 verts[3];
+	glm::ivec2 snapped[3];
+	float const* varyings[3];
+	int const* varyingSizes;
+	int numVaryings;
+	int numComponents;
+};
+
+typedef void (*RasteriserFunc) (Renderer* renderer, Shader const& fsh, TriangleData const& triangle, TileRect const& tile, RasterStats& stats);
+inline glm::vec4& 	get_triangle_vert0(TriangleData& vd) 	{ return vd.verts[0]; }
+inline glm::vec4& 	get_triangle_vert1(TriangleData& vd) 	{ return vd.verts[1]; }
+inline glm::vec4& 	get_triangle_vert2(TriangleData& vd) 	{ return vd.verts[2]; }
+inline glm::vec4 const& 	get_triangle_vert0(TriangleData const& vd) 	{ return vd.verts[0]; }
+inline glm::vec4 const& 	get_triangle_vert1(TriangleData const& vd) 	{ return vd.verts[1]; }
+inline glm::vec4 const& 	get_triangle_vert2(TriangleData const& vd) 	{ return vd.verts[2]; }
+inline float const* get_triangle_varying0(TriangleData const& vd) { return vd.varyings[0]; }
+inline float const* get_triangle_varying1(TriangleData const& vd) { return vd.varyings[1]; }
+inline float const* get_triangle_varying2(TriangleData const& vd) { return vd.varyings[2]; }
+
+// Screen-space bounding box of a window-space triangle, clamped to a
+// width x height target. Empty (minx > maxx or miny > maxy) when off screen.
+inline TileRect triangle_bounds(TriangleData const& triangle, size_t width, size_t height) {
+	glm::vec4 const& p0 = get_triangle_vert0(triangle);
+	glm::vec4 const& p1 = get_triangle_vert1(triangle);
+	glm::vec4 const& p2 = get_triangle_vert2(triangle);
+	TileRect bounds;
+	bounds.minx = iround(std::max(0.0f, std::min(std::min(p0.x, p1.x), p2.x)));
+	bounds.miny = iround(std::max(0.0f, std::min(std::min(p0.y, p1.y), p2.y)));
+	bounds.maxx = iround(std::min(float(width - 1),  std::max(std::max(p0.x, p1.x), p2.x)));
+	bounds.maxy = iround(std::min(float(height - 1), std::max(std::max(p0.y, p1.y), p2.y)));
+	return bounds;
+}
+
+// Rounds the x and y of count window space positions to the nearest point of
+// a grid with subpixelBits fractional bits, several positions at a time
+// where the CPU allows. Every path rounds exactly as iround does.
+void snap_vertices(glm::vec4 const* positions, size_t count, int subpixelBits, glm::ivec2* snapped);
+
+// Twice the signed area of a snapped triangle, in squared subpixel units.
+// Positive for the winding the rasteriser covers and zero for triangles that
+// cover nothing.
+int64_t snapped_area(glm::ivec2 const& p0, glm::ivec2 const& p1, glm::ivec2 const& p2);
+
+void default_rasteriser(Renderer* renderer, Shader const& fsh, TriangleData const& triangle, TileRect const& tile, RasterStats& stats);
+
+#endif // JHSR_DEFAULT_RASTERISER_HPP
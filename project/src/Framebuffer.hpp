@@ -5,12 +5,42 @@
 #include <cstring>
 #include <cassert>
 #include <cstdio>
+#include <vector>
+#include <algorithm>
+
+// Linear stores rows one after another. Tiled stores MICRO_TILE_SIZE square
+// micro tiles one after another, in row order, with each tile's pixels row by
+// row, so a block of pixels the rasteriser works on spans a few cache lines
+// rather than one per row.
+enum class FramebufferLayout
+{
+	Linear,
+	Tiled
+};
+
+// Typed surfaces know what their pixels hold, which lets the rasterisers
+// write them directly instead of going through set_pixel. Untyped is the
+// original interface, any number of bytes per pixel with no interpretation.
+enum class PixelFormat
+{
+	Untyped,
+	RGBA8,
+	R32F,
+	R16,
+	RGBA32F
+};
+
+size_t pixel_format_size(PixelFormat format);
 
 class Framebuffer
 {
 public:
 
-	Framebuffer(size_t width, size_t height, size_t bytesPerPixel);
+	enum : int { MICRO_TILE_SIZE = 8, ALIGNMENT = 64 };
+
+	Framebuffer(size_t width, size_t height, size_t bytesPerPixel, FramebufferLayout layout = FramebufferLayout::Linear);
+
+	Framebuffer(size_t width, size_t height, PixelFormat format, FramebufferLayout layout = FramebufferLayout::Linear);
 
 	~Framebuffer();
 
@@ -20,6 +50,10 @@ public:
 
 	size_t bytes_per_pixel() const;
 
+	FramebufferLayout layout() const;
+
+	PixelFormat format() const;
+
 	void clear(void const* value);
 
 	void set_pixel(size_t x, size_t y, void const* pixel);
@@ -28,25 +62,96 @@ public:
 
 	void get_pixel(size_t x, size_t y, void* result) const;
 
+	// Pixel (x, y) in the buffer's own layout. Pixels to its right are
+	// contiguous up to the end of its micro tile row, or of the row when
+	// the layout is linear.
+	void* pixel_address(size_t x, size_t y);
+
+	void const* pixel_address(size_t x, size_t y) const;
+
+	// Pixel (x, y) as a T, which must be the size of a pixel.
+	template< typename T >
+	T& pixel(size_t x, size_t y);
+
+	template< typename T >
+	T const& pixel(size_t x, size_t y) const;
+
+	// Copies the contents into linear, width * height pixels row by row.
+	void resolve(void* linear) const;
+
+	// The contents in linear layout. Tiled buffers are resolved into a copy
+	// owned by the framebuffer, which stays valid until the next call.
 	void const* pixels() const;
 
+	// Bumped by clear and set_row, so anything derived from the contents can
+	// tell when it needs rebuilding. Single pixel writes don't bump it.
+	size_t version() const;
+
 private:
 
+	void allocate();
+
+	size_t pixel_index(size_t x, size_t y) const;
+
+	size_t storage_pixels() const;
+
+	uint8_t* _storage;
 	uint8_t* _pixels;
 	size_t _width, _height, _bytesPerPixel;
+	PixelFormat _format;
+	FramebufferLayout _layout;
+	size_t _tilesX, _tilesY;
+	size_t _version;
+	mutable std::vector< uint8_t > _resolved;
 };
 
 
-inline Framebuffer::Framebuffer(size_t width, size_t height, size_t bytesPerPixel)
-: _width(width), _height(height), _bytesPerPixel(bytesPerPixel) {
-	assert(width > 0);
-	assert(height > 0);
-	_pixels = new uint8_t[width * height * bytesPerPixel];
-	std::memset(_pixels, 0, sizeof(uint8_t) * width * height * bytesPerPixel);
+inline size_t pixel_format_size(PixelFormat format) {
+	switch (format) {
+		case PixelFormat::RGBA8:   return 4;
+		case PixelFormat::R32F:    return 4;
+		case PixelFormat::R16:     return 2;
+		case PixelFormat::RGBA32F: return 16;
+		default:                   { assert(false); return 0; }
+	}
+}
+
+inline Framebuffer::Framebuffer(size_t width, size_t height, size_t bytesPerPixel, FramebufferLayout layout)
+: _width(width), _height(height), _bytesPerPixel(bytesPerPixel), _format(PixelFormat::Untyped), _layout(layout), _version(0) {
+	allocate();
+}
+
+inline Framebuffer::Framebuffer(size_t width, size_t height, PixelFormat format, FramebufferLayout layout)
+: _width(width), _height(height), _bytesPerPixel(pixel_format_size(format)), _format(format), _layout(layout), _version(0) {
+	allocate();
 }
 
 inline Framebuffer::~Framebuffer() {
-	delete [] _pixels;
+	delete [] _storage;
+}
+
+// Storage starts on an ALIGNMENT boundary, so micro tiles, and rows whose
+// size is a multiple of it, start on a cache line.
+inline void Framebuffer::allocate() {
+	assert(_width > 0);
+	assert(_height > 0);
+	assert(_bytesPerPixel > 0);
+
+	// Tiled storage is padded out to whole micro tiles
+	_tilesX = (_width + MICRO_TILE_SIZE - 1) / MICRO_TILE_SIZE;
+	_tilesY = (_height + MICRO_TILE_SIZE - 1) / MICRO_TILE_SIZE;
+	size_t bytes = storage_pixels() * _bytesPerPixel;
+	_storage = new uint8_t[bytes + ALIGNMENT - 1];
+	_pixels = _storage + ((ALIGNMENT - (reinterpret_cast< uintptr_t >(_storage) % ALIGNMENT)) % ALIGNMENT);
+	std::memset(_pixels, 0, bytes);
+}
+
+inline size_t Framebuffer::storage_pixels() const {
+	if (_layout == FramebufferLayout::Tiled) {
+		return _tilesX * _tilesY * MICRO_TILE_SIZE * MICRO_TILE_SIZE;
+	}
+
+	return _width * _height;
 }
 
 inline size_t Framebuffer::width() const {
@@ -61,39 +166,124 @@ inline size_t Framebuffer::bytes_per_pixel() const {
 	return _bytesPerPixel;
 }
 
+inline FramebufferLayout Framebuffer::layout() const {
+	return _layout;
+}
+
+inline PixelFormat Framebuffer::format() const {
+	return _format;
+}
+
+inline size_t Framebuffer::pixel_index(size_t x, size_t y) const {
+	if (_layout == FramebufferLayout::Linear) {
+		return (y * _width) + x;
+	}
+
+	size_t tile = ((y / MICRO_TILE_SIZE) * _tilesX) + (x / MICRO_TILE_SIZE);
+	return (tile * MICRO_TILE_SIZE * MICRO_TILE_SIZE) + ((y % MICRO_TILE_SIZE) * MICRO_TILE_SIZE) + (x % MICRO_TILE_SIZE);
+}
+
+// Fills a chunk of whole pixels at the start of storage by doubling, then
+// copies that chunk, which stays in L1, over the rest. Runs at memcpy speed
+// for any pixel size.
 inline void Framebuffer::clear(void const* value) {
-	uint8_t* val = (uint8_t*)value;
-	for (size_t i = 0; i < _height * _width * _bytesPerPixel; i += _bytesPerPixel) {
-		for (int j = 0; j < _bytesPerPixel; ++j) {
-			_pixels[i + j] = val[j];
+	size_t bytes = storage_pixels() * _bytesPerPixel;
+	uint8_t const* val = static_cast< uint8_t const* >(value);
+	if (std::count(val, val + _bytesPerPixel, val[0]) == std::ptrdiff_t(_bytesPerPixel)) {
+		std::memset(_pixels, val[0], bytes);
+	}
+	else {
+		size_t chunk = std::min(bytes, std::max(size_t(4096) - (size_t(4096) % _bytesPerPixel), _bytesPerPixel));
+		std::memcpy(_pixels, val, _bytesPerPixel);
+		for (size_t filled = _bytesPerPixel; filled < chunk; filled *= 2) {
+			std::memcpy(_pixels + filled, _pixels, std::min(filled, chunk - filled));
+		}
+
+		for (size_t offset = chunk; offset < bytes; offset += chunk) {
+			std::memcpy(_pixels + offset, _pixels, std::min(chunk, bytes - offset));
 		}
 	}
+
+	++_version;
 }
 
 inline void Framebuffer::set_pixel(size_t x, size_t y, void const* pixel) {
 	assert(x >= 0 && x < _width);
 	assert(y >= 0 && y < _height);
-	uint8_t* p = (uint8_t*)pixel;
-	size_t offset = (y * _width * _bytesPerPixel) + (x * _bytesPerPixel);
-	for (size_t i = 0; i < _bytesPerPixel; ++i, ++offset) {
-		_pixels[offset] = p[i];
-	}
+	std::memcpy(_pixels + (pixel_index(x, y) * _bytesPerPixel), pixel, _bytesPerPixel);
 }
 
 inline void Framebuffer::set_row(size_t row, void const* rowPixels) {
 	assert(row >= 0 && row < _height);
-	std::memcpy(_pixels + (row * _width * _bytesPerPixel), rowPixels, _width * _bytesPerPixel);
+	uint8_t const* src = static_cast< uint8_t const* >(rowPixels);
+	if (_layout == FramebufferLayout::Linear) {
+		std::memcpy(_pixels + (row * _width * _bytesPerPixel), src, _width * _bytesPerPixel);
+	}
+	else {
+		for (size_t x = 0; x < _width; x += MICRO_TILE_SIZE) {
+			size_t span = std::min(size_t(MICRO_TILE_SIZE), _width - x);
+			std::memcpy(pixel_address(x, row), src + (x * _bytesPerPixel), span * _bytesPerPixel);
+		}
+	}
+
+	++_version;
 }
 
 inline void Framebuffer::get_pixel(size_t x, size_t y, void* result) const {
 	assert(x >= 0 && x < _width);
 	assert(y >= 0 && y < _height);
-	std::memcpy(result, _pixels + (y * _width * _bytesPerPixel) + (x * _bytesPerPixel), _bytesPerPixel);
+	std::memcpy(result, _pixels + (pixel_index(x, y) * _bytesPerPixel), _bytesPerPixel);
 }
 
+inline void* Framebuffer::pixel_address(size_t x, size_t y) {
+	return _pixels + (pixel_index(x, y) * _bytesPerPixel);
+}
+
+inline void const* Framebuffer::pixel_address(size_t x, size_t y) const {
+	return _pixels + (pixel_index(x, y) * _bytesPerPixel);
+}
+
+template< typename T >
+inline T& Framebuffer::pixel(size_t x, size_t y) {
+	assert(sizeof(T) == _bytesPerPixel);
+	assert(x < _width && y < _height);
+	return *reinterpret_cast< T* >(_pixels + (pixel_index(x, y) * sizeof(T)));
+}
+
+template< typename T >
+inline T const& Framebuffer::pixel(size_t x, size_t y) const {
+	assert(sizeof(T) == _bytesPerPixel);
+	assert(x < _width && y < _height);
+	return *reinterpret_cast< T const* >(_pixels + (pixel_index(x, y) * sizeof(T)));
+}
+
+inline void Framebuffer::resolve(void* linear) const {
+	uint8_t* dst = static_cast< uint8_t* >(linear);
+	if (_layout == FramebufferLayout::Linear) {
+		std::memcpy(dst, _pixels, _width * _height * _bytesPerPixel);
+		return;
+	}
+
+	for (size_t y = 0; y < _height; ++y) {
+		for (size_t x = 0; x < _width; x += MICRO_TILE_SIZE) {
+			size_t span = std::min(size_t(MICRO_TILE_SIZE), _width - x);
+			std::memcpy(dst + (((y * _width) + x) * _bytesPerPixel), pixel_address(x, y), span * _bytesPerPixel);
+		}
+	}
+}
 
 inline void const* Framebuffer::pixels() const {
-	return _pixels;
+	if (_layout == FramebufferLayout::Linear) {
+		return _pixels;
+	}
+
+	_resolved.resize(_width * _height * _bytesPerPixel);
+	resolve(_resolved.data());
+	return _resolved.data();
+}
+
+inline size_t Framebuffer::version() const {
+	return _version;
 }
 
-#endif // JHSR_FRAMEBUFFER
\ No newline at end of file
+#endif // JHSR_FRAMEBUFFER_HPP
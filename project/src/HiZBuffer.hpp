@@ -0,0 +1,198 @@
+#ifndef JHSR_HIZBUFFER_HPP
+#define JHSR_HIZBUFFER_HPP
+
+#include "Framebuffer.hpp"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cassert>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Coarse max depth kept alongside the depth buffer. The fine level holds the
+// max depth of each screen aligned block, the coarse level the max of each
+// tile's blocks. Depth tests that only pass z at or in front of the stored
+// depth can't pass anything whose min z is greater than a cell's max
+// anywhere in the cell.
+//
+// Cells only ever overestimate: they're recomputed after a rasteriser writes
+// to a block, and rebuilt whenever the depth buffer is cleared or written a
+// row at a time. Tiles line up with the renderer's bins, so a thread only ever
+// touches the cells of the tiles it owns.
+class HiZBuffer
+{
+public:
+
+	HiZBuffer();
+
+	void resize(size_t width, size_t height, int blockSize, int tileSize);
+
+	// Rebuilds every cell if depth has been cleared or had rows written since
+	// the last sync.
+	void sync(Framebuffer const& depth);
+
+	// Sets every cell to value after depth has been cleared to it, which
+	// leaves nothing for sync() to rebuild.
+	void clear(Framebuffer const& depth, float value);
+
+	float block_max(int bx, int by) const;
+
+	// Max over every tile the inclusive pixel rect touches.
+	float max_depth(int minx, int miny, int maxx, int maxy) const;
+
+	// Recomputes block (bx, by) from depth after it has been written.
+	void update_block(Framebuffer const& depth, int bx, int by);
+
+private:
+
+	float compute_block(Framebuffer const& depth, int bx, int by) const;
+
+	float compute_tile(int tx, int ty) const;
+
+	int _blockSize, _tileBlocks;
+	size_t _blocksX, _blocksY;
+	size_t _tilesX, _tilesY;
+	std::vector< float > _blocks;
+	std::vector< float > _tiles;
+	size_t _version;
+};
+
+
+inline HiZBuffer::HiZBuffer()
+: _blockSize(1), _tileBlocks(1), _blocksX(0), _blocksY(0), _tilesX(0), _tilesY(0), _version(size_t(-1)) {
+
+}
+
+inline void HiZBuffer::resize(size_t width, size_t height, int blockSize, int tileSize) {
+	assert(blockSize > 0 && tileSize % blockSize == 0);
+	assert(Framebuffer::MICRO_TILE_SIZE % blockSize == 0);
+	_blockSize = blockSize;
+	_tileBlocks = tileSize / blockSize;
+	_blocksX = (width + blockSize - 1) / blockSize;
+	_blocksY = (height + blockSize - 1) / blockSize;
+	_tilesX = (_blocksX + _tileBlocks - 1) / _tileBlocks;
+	_tilesY = (_blocksY + _tileBlocks - 1) / _tileBlocks;
+	_blocks.assign(_blocksX * _blocksY, INFINITY);
+	_tiles.assign(_tilesX * _tilesY, INFINITY);
+	_version = size_t(-1);
+}
+
+inline void HiZBuffer::sync(Framebuffer const& depth) {
+	if (depth.version() == _version) {
+		return;
+	}
+
+	for (size_t by = 0; by < _blocksY; ++by) {
+		for (size_t bx = 0; bx < _blocksX; ++bx) {
+			_blocks[(by * _blocksX) + bx] = compute_block(depth, int(bx), int(by));
+		}
+	}
+
+	for (size_t ty = 0; ty < _tilesY; ++ty) {
+		for (size_t tx = 0; tx < _tilesX; ++tx) {
+			_tiles[(ty * _tilesX) + tx] = compute_tile(int(tx), int(ty));
+		}
+	}
+
+	_version = depth.version();
+}
+
+inline void HiZBuffer::clear(Framebuffer const& depth, float value) {
+	std::fill(_blocks.begin(), _blocks.end(), value);
+	std::fill(_tiles.begin(), _tiles.end(), value);
+	_version = depth.version();
+}
+
+inline float HiZBuffer::block_max(int bx, int by) const {
+	return _blocks[(size_t(by) * _blocksX) + bx];
+}
+
+inline float HiZBuffer::max_depth(int minx, int miny, int maxx, int maxy) const {
+	int tileSize = _blockSize * _tileBlocks;
+	float result = -INFINITY;
+	for (int ty = miny / tileSize; ty <= maxy / tileSize; ++ty) {
+		for (int tx = minx / tileSize; tx <= maxx / tileSize; ++tx) {
+			result = std::max(result, _tiles[(size_t(ty) * _tilesX) + tx]);
+		}
+	}
+
+	return result;
+}
+
+inline void HiZBuffer::update_block(Framebuffer const& depth, int bx, int by) {
+	float& cell = _blocks[(size_t(by) * _blocksX) + bx];
+	float previous = cell;
+	cell = compute_block(depth, bx, by);
+
+	// A block that moved away raises the tile max to its own, and one that
+	// moved closer can only lower it if the block held it.
+	int tx = bx / _tileBlocks, ty = by / _tileBlocks;
+	float& tile = _tiles[(size_t(ty) * _tilesX) + tx];
+	if (cell > tile) {
+		tile = cell;
+	}
+	else if (cell < previous && !(previous < tile)) {
+		tile = compute_tile(tx, ty);
+	}
+}
+
+// Multisampled depth buffers hold a float per sample, and a block's max is
+// taken over all of them. Four running maxes rather than one, one per SSE
+// lane where there is SSE, keep the loop from waiting on each max in turn.
+inline float HiZBuffer::compute_block(Framebuffer const& depth, int bx, int by) const {
+	assert(depth.format() == PixelFormat::R32F || (depth.format() == PixelFormat::Untyped && depth.bytes_per_pixel() % sizeof(float) == 0));
+	size_t samples = depth.bytes_per_pixel() / sizeof(float);
+	size_t x0 = size_t(bx) * _blockSize, x1 = std::min(x0 + _blockSize, depth.width());
+	size_t y0 = size_t(by) * _blockSize, y1 = std::min(y0 + _blockSize, depth.height());
+	float result[4] = { -INFINITY, -INFINITY, -INFINITY, -INFINITY };
+#if defined(__SSE2__)
+	__m128 vresult = _mm_set1_ps(-INFINITY);
+#endif
+	for (size_t y = y0; y < y1; ++y) {
+		float const* row = static_cast< float const* >(depth.pixel_address(x0, y));
+		size_t count = (x1 - x0) * samples, i = 0;
+#if defined(__SSE2__)
+		// maxps keeps its second operand when either is NaN, as std::max does
+		for (; i + 4 <= count; i += 4) {
+			vresult = _mm_max_ps(_mm_loadu_ps(row + i), vresult);
+		}
+#else
+		for (; i + 4 <= count; i += 4) {
+			for (int k = 0; k < 4; ++k) {
+				result[k] = std::max(result[k], row[i + k]);
+			}
+		}
+#endif
+
+		for (; i < count; ++i) {
+			result[0] = std::max(result[0], row[i]);
+		}
+	}
+
+#if defined(__SSE2__)
+	float lanes[4];
+	_mm_storeu_ps(lanes, vresult);
+	for (int k = 0; k < 4; ++k) {
+		result[k] = std::max(result[k], lanes[k]);
+	}
+#endif
+
+	return std::max(std::max(result[0], result[1]), std::max(result[2], result[3]));
+}
+
+inline float HiZBuffer::compute_tile(int tx, int ty) const {
+	size_t bx0 = size_t(tx) * _tileBlocks, bx1 = std::min(bx0 + _tileBlocks, _blocksX);
+	size_t by0 = size_t(ty) * _tileBlocks, by1 = std::min(by0 + _tileBlocks, _blocksY);
+	float result = -INFINITY;
+	for (size_t by = by0; by < by1; ++by) {
+		for (size_t bx = bx0; bx < bx1; ++bx) {
+			result = std::max(result, _blocks[(by * _blocksX) + bx]);
+		}
+	}
+
+	return result;
+}
+
+#endif // JHSR_HIZBUFFER_HPP
@@ -0,0 +1,252 @@
+#include "MeshOptimizer.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cassert>
+
+// The triangles that use each vertex, in list order, as one array indexed
+// by offsets
+struct VertexTriangles
+{
+	VertexTriangles(int32_t const* indices, size_t count, size_t vertexCount);
+
+	uint32_t const* begin(int32_t v) const { return triangles.data() + offsets[v]; }
+	uint32_t const* end(int32_t v) const { return triangles.data() + offsets[v + 1]; }
+
+	std::vector< uint32_t > offsets;
+	std::vector< uint32_t > triangles;
+};
+
+VertexTriangles::VertexTriangles(int32_t const* indices, size_t count, size_t vertexCount)
+: offsets(vertexCount + 1, 0),
+  triangles(count) {
+	for (size_t i = 0; i < count; ++i) {
+		assert(indices[i] >= 0 && size_t(indices[i]) < vertexCount);
+		++offsets[indices[i] + 1];
+	}
+
+	for (size_t v = 0; v < vertexCount; ++v) {
+		offsets[v + 1] += offsets[v];
+	}
+
+	std::vector< uint32_t > next(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < count; ++i) {
+		triangles[next[indices[i]]++] = uint32_t(i / 3);
+	}
+}
+
+static inline bool degenerate(int32_t a, int32_t b, int32_t c) {
+	return a == b || b == c || c == a;
+}
+
+// Looks vertices up the way Renderer::process_primitives does, strips
+// included, through a FIFO where a vertex is resident until cacheSize
+// misses after its own
+float cache_miss_ratio(int32_t const* indices, size_t count, PrimitiveTopology topology, size_t cacheSize) {
+	if (count < 3) {
+		return 0.0f;
+	}
+
+	int32_t maxIndex = *std::max_element(indices, indices + count);
+	std::vector< size_t > inserted(size_t(maxIndex) + 1, 0);
+	size_t misses = 0, triangles = 0;
+	bool strip = topology == PrimitiveTopology::TriangleStrip;
+	for (size_t i = 2; i < count; i += strip ? 1 : 3) {
+		int32_t triangle[] = { indices[i - 2], indices[i - 1], indices[i] };
+		if (strip && (i % 2) == 1) {
+			std::swap(triangle[0], triangle[1]);
+		}
+
+		triangles += degenerate(triangle[0], triangle[1], triangle[2]) ? 0 : 1;
+		for (int32_t v : triangle) {
+			size_t& time = inserted[v];
+			if (time == 0 || (cacheSize != 0 && misses - time >= cacheSize)) {
+				time = ++misses;
+			}
+		}
+	}
+
+	return (triangles == 0) ? 0.0f : float(misses) / float(triangles);
+}
+
+// Follows the paper's pseudocode. A vertex is in the emulated cache while
+// fewer than cacheSize vertices have been added since it was, and the fan
+// moves to the candidate that has been in the cache longest and will still
+// be there once its remaining triangles are emitted, or failing that, any
+// candidate with triangles left.
+void optimize_vertex_cache(int32_t* indices, size_t count, size_t vertexCount, size_t cacheSize) {
+	assert(count % 3 == 0);
+	if (cacheSize == 0 || count == 0) {
+		return;
+	}
+
+	VertexTriangles adjacency(indices, count, vertexCount);
+	std::vector< uint32_t > live(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v) {
+		live[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+	}
+
+	std::vector< size_t > cached(vertexCount, 0);
+	std::vector< uint8_t > emitted(count / 3, 0);
+	std::vector< int32_t > deadEnds, candidates, result;
+	result.reserve(count);
+	size_t time = cacheSize + 1, cursor = 0;
+	int32_t fan = 0;
+	while (fan >= 0) {
+		candidates.clear();
+		for (uint32_t const* t = adjacency.begin(fan); t != adjacency.end(fan); ++t) {
+			if (emitted[*t]) {
+				continue;
+			}
+
+			for (int k = 0; k < 3; ++k) {
+				int32_t v = indices[(*t * 3) + k];
+				result.push_back(v);
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				--live[v];
+				if (time - cached[v] > cacheSize) {
+					cached[v] = time++;
+				}
+			}
+
+			emitted[*t] = 1;
+		}
+
+		fan = -1;
+		size_t best = 0;
+		for (int32_t v : candidates) {
+			if (live[v] == 0) {
+				continue;
+			}
+
+			size_t priority = (time - cached[v] + (2 * live[v]) <= cacheSize) ? time - cached[v] : 0;
+			if (fan < 0 || priority > best) {
+				fan = v;
+				best = priority;
+			}
+		}
+
+		// A dead end: the most recently used vertex with triangles left,
+		// or else the next one in index order
+		while (fan < 0 && !deadEnds.empty()) {
+			int32_t v = deadEnds.back();
+			deadEnds.pop_back();
+			fan = (live[v] > 0) ? v : -1;
+		}
+
+		for (; fan < 0 && cursor < vertexCount; ++cursor) {
+			fan = (live[cursor] > 0) ? int32_t(cursor) : -1;
+		}
+	}
+
+	assert(result.size() == count);
+	std::copy(result.begin(), result.end(), indices);
+}
+
+std::vector< int32_t > optimize_vertex_fetch(int32_t* indices, size_t count, size_t vertexCount) {
+	std::vector< int32_t > remap(vertexCount, -1);
+	int32_t next = 0;
+	for (size_t i = 0; i < count; ++i) {
+		assert(indices[i] >= 0 && size_t(indices[i]) < vertexCount);
+		int32_t& index = remap[indices[i]];
+		if (index < 0) {
+			index = next++;
+		}
+
+		indices[i] = index;
+	}
+
+	return remap;
+}
+
+void remap_vertices(void const* vertices, size_t vertexCount, size_t vertexSize, std::vector< int32_t > const& remap, void* result) {
+	assert(remap.size() == vertexCount);
+	uint8_t const* in = static_cast< uint8_t const* >(vertices);
+	uint8_t* out = static_cast< uint8_t* >(result);
+	for (size_t v = 0; v < vertexCount; ++v) {
+		if (remap[v] >= 0) {
+			std::memcpy(out + (size_t(remap[v]) * vertexSize), in + (v * vertexSize), vertexSize);
+		}
+	}
+}
+
+// Each strip starts from the first triangle not yet in one, turned so that
+// it can continue if any turn can, and grows across the edge its last two
+// vertices share until no unused triangle is there. Triangle j of a strip
+// is drawn as (s[j], s[j + 1], s[j + 2]) when j is even and with the first
+// two swapped when it's odd, so the next triangle must hold that edge the
+// opposite way round to the last, and the strip's winding is the list's.
+std::vector< int32_t > build_strip(int32_t const* indices, size_t count, size_t vertexCount) {
+	assert(count % 3 == 0);
+	VertexTriangles adjacency(indices, count, vertexCount);
+	std::vector< uint8_t > used(count / 3, 0);
+
+	// The unused triangle holding the directed edge x -> y, and its third
+	// vertex, or -1
+	auto across = [&] (int32_t x, int32_t y, int32_t& third) -> int64_t {
+		for (uint32_t const* t = adjacency.begin(x); t != adjacency.end(x); ++t) {
+			int32_t const* triangle = indices + (*t * 3);
+			for (int k = 0; k < 3 && !used[*t]; ++k) {
+				if (triangle[k] == x && triangle[(k + 1) % 3] == y) {
+					third = triangle[(k + 2) % 3];
+					return *t;
+				}
+			}
+		}
+
+		return -1;
+	};
+
+	std::vector< int32_t > strips, strip;
+	for (size_t t = 0; t < count / 3; ++t) {
+		if (used[t]) {
+			continue;
+		}
+
+		int32_t const* triangle = indices + (t * 3);
+		int first = 0, third;
+		for (int k = 0; k < 3; ++k) {
+			if (across(triangle[(k + 2) % 3], triangle[(k + 1) % 3], third) >= 0) {
+				first = k;
+				break;
+			}
+		}
+
+		used[t] = 1;
+		strip.assign({ triangle[first], triangle[(first + 1) % 3], triangle[(first + 2) % 3] });
+		for (;;) {
+			size_t n = strip.size();
+			bool odd = (n % 2) == 1;
+			int64_t next = odd ? across(strip[n - 1], strip[n - 2], third) : across(strip[n - 2], strip[n - 1], third);
+			if (next < 0) {
+				break;
+			}
+
+			used[next] = 1;
+			strip.push_back(third);
+		}
+
+		append_strip(strips, strip.data(), strip.size());
+	}
+
+	return strips;
+}
+
+// Repeating the last vertex of one strip and the first of the next gives
+// triangles that each repeat a vertex. One more repeat of the first keeps
+// the next strip's first triangle even.
+void append_strip(std::vector< int32_t >& strips, int32_t const* strip, size_t count) {
+	if (count == 0) {
+		return;
+	}
+
+	if (!strips.empty()) {
+		strips.push_back(strips.back());
+		strips.push_back(strip[0]);
+		if ((strips.size() % 2) == 1) {
+			strips.push_back(strip[0]);
+		}
+	}
+
+	strips.insert(strips.end(), strip, strip + count);
+}
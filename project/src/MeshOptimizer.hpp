@@ -0,0 +1,52 @@
+#ifndef JHSR_MESHOPTIMIZER_HPP
+#define JHSR_MESHOPTIMIZER_HPP
+
+#include "Renderer.hpp"
+#include <vector>
+#include <cstdint>
+
+// Offline reordering of indexed meshes for draw_indexed. The usual sequence
+// is
+//
+//   optimize_vertex_cache(indices, count, vertexCount, renderer.vertex_cache().size());
+//   std::vector< int32_t > remap = optimize_vertex_fetch(indices, count, vertexCount);
+//   remap_vertices(vertices, vertexCount, sizeof(Vertex), remap, reordered);
+//
+// followed, optionally, by build_strip. None of it changes which triangles
+// are drawn or their winding, only the order they are drawn in.
+
+// Average cache miss ratio: the vertices shaded per triangle when indices
+// are drawn with topology through a FIFO post-transform cache of cacheSize
+// entries, like VertexCache. Triangles with repeated vertices, the joins
+// between strips, aren't counted. 3 is the worst a list can do and about
+// 0.5 the best for a large regular mesh.
+float cache_miss_ratio(int32_t const* indices, size_t count, PrimitiveTopology topology, size_t cacheSize);
+
+// Reorders the triangles of a list for a FIFO cache of cacheSize entries,
+// in time linear in the number of triangles. This is Tipsify, from Sander,
+// Nehab and Barczak's "Fast Triangle Reordering for Vertex Locality and
+// Reduced Overdraw": it fans around one vertex at a time and moves on to a
+// neighbour that is still in the cache.
+void optimize_vertex_cache(int32_t* indices, size_t count, size_t vertexCount, size_t cacheSize);
+
+// Renumbers vertices in the order the list first uses them, so vertex
+// fetches walk the vertex buffer forwards, and rewrites indices to match.
+// Returns the new index of each vertex, or -1 for vertices nothing uses,
+// which are dropped.
+std::vector< int32_t > optimize_vertex_fetch(int32_t* indices, size_t count, size_t vertexCount);
+
+// Moves each vertexSize byte vertex of vertices to remap[i] in result, which
+// must hold as many vertices as remap has non-negative entries
+void remap_vertices(void const* vertices, size_t vertexCount, size_t vertexSize, std::vector< int32_t > const& remap, void* result);
+
+// Turns a list into one strip for PrimitiveTopology::TriangleStrip, greedily
+// following shared edges in the list's order. Strips are joined with
+// triangles that repeat a vertex, which cover nothing, and every triangle
+// keeps its winding.
+std::vector< int32_t > build_strip(int32_t const* indices, size_t count, size_t vertexCount);
+
+// Appends strip to strips, joined the way build_strip joins them, so that
+// its first triangle keeps its winding
+void append_strip(std::vector< int32_t >& strips, int32_t const* strip, size_t count);
+
+#endif // JHSR_MESHOPTIMIZER_HPP
@@ -0,0 +1,182 @@
+// Offline mesh optimiser. Reorders the triangles of a binary PLY mesh for the
+// renderer's post-transform vertex cache and its vertices for fetch locality,
+// and writes the result as a new PLY file in the same format. Needs neither
+// OpenGL nor GLUT.
+//
+//   mesh-optimizer [--cache N] [--strip] [--keep-vertices] input.ply output.ply
+//
+// --cache sets the cache size optimised for, VertexCache's default if it's
+// left out. --keep-vertices leaves the vertices in their order, otherwise
+// they're renumbered in the order the triangles first use them and any that
+// no triangle uses are dropped. --strip writes a tristrips element holding
+// one strip, for PrimitiveTopology::TriangleStrip, instead of a face list.
+// Faces are written as triangles, and elements other than vertex and face
+// are left out. The average cache miss ratio is reported before and after.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "MeshOptimizer.hpp"
+#include "PLYLoader.hpp"
+#include "VertexCache.hpp"
+
+template< typename T >
+void append(std::vector< uint8_t >& data, T value, bool swap) {
+    uint8_t bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    if (swap) {
+        std::reverse(bytes, bytes + sizeof(T));
+    }
+
+    data.insert(data.end(), bytes, bytes + sizeof(T));
+}
+
+bool host_big_endian() {
+    uint16_t one = 1;
+    uint8_t first;
+    std::memcpy(&first, &one, 1);
+    return first == 0;
+}
+
+// Copies the vertex element's header lines, which are the same whatever
+// order the vertices are in
+std::string vertex_header(PLYLoader::Element const& vertices, size_t count) {
+    std::string header = "element vertex " + std::to_string(count) + "\n";
+    for (PLYLoader::Property const& property : vertices.properties) {
+        header += std::string("property ") + ply_type_name(property.type) + " " + property.name + "\n";
+    }
+
+    return header;
+}
+
+bool write_ply(std::string const& path, std::string const& header, std::vector< uint8_t > const& vertices, std::vector< uint8_t > const& indices) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    bool ok = std::fwrite(header.data(), 1, header.size(), file) == header.size();
+    ok = ok && std::fwrite(vertices.data(), 1, vertices.size(), file) == vertices.size();
+    ok = ok && std::fwrite(indices.data(), 1, indices.size(), file) == indices.size();
+    return (std::fclose(file) == 0) && ok;
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    size_t cacheSize = VertexCache().size();
+    bool strip = false, keepVertices = false;
+    std::vector< std::string > paths;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--strip") {
+            strip = true;
+        }
+        else if (arg == "--keep-vertices") {
+            keepVertices = true;
+        }
+        else if (arg == "--cache" && i + 1 < argc) {
+            cacheSize = size_t(std::atoi(argv[++i]));
+        }
+        else if (arg.compare(0, 2, "--") != 0) {
+            paths.push_back(arg);
+        }
+        else {
+            std::fprintf(stderr, "unknown or incomplete option %s\n", arg.c_str());
+            return 2;
+        }
+    }
+
+    if (paths.size() != 2 || cacheSize == 0) {
+        std::fprintf(stderr, "usage: mesh-optimizer [--cache N] [--strip] [--keep-vertices] input.ply output.ply\n");
+        return 2;
+    }
+
+    PLYLoader ply;
+    std::vector< int32_t > indices;
+    if (!ply.open(paths[0]) || !ply.read_faces(indices)) {
+        std::fprintf(stderr, "%s: %s\n", paths[0].c_str(), ply.error().c_str());
+        return 1;
+    }
+
+    PLYLoader::Element const* vertices = ply.element("vertex");
+    if (vertices == nullptr || vertices->recordSize == 0) {
+        std::fprintf(stderr, "%s: vertices with list properties aren't supported\n", paths[0].c_str());
+        return 1;
+    }
+
+    for (PLYLoader::Element const& element : ply.elements()) {
+        if (element.name != "vertex" && element.name != "face") {
+            std::fprintf(stderr, "warning: leaving out element %s\n", element.name.c_str());
+        }
+    }
+
+    size_t vertexCount = vertices->count;
+    std::printf("%zu vertices, %zu triangles, %zu entry cache\n", vertexCount, indices.size() / 3, cacheSize);
+    std::printf("before:   ACMR %.3f\n", cache_miss_ratio(indices.data(), indices.size(), PrimitiveTopology::TriangleList, cacheSize));
+
+    auto start = std::chrono::steady_clock::now();
+    optimize_vertex_cache(indices.data(), indices.size(), vertexCount, cacheSize);
+    double ms = elapsed_ms(start);
+    std::printf("reorder:  ACMR %.3f in %.1f ms\n", cache_miss_ratio(indices.data(), indices.size(), PrimitiveTopology::TriangleList, cacheSize), ms);
+
+    // Vertex records are copied as they are, so the output keeps the input's
+    // byte order
+    std::vector< uint8_t > vertexData;
+    size_t outputVertices = vertexCount;
+    if (keepVertices) {
+        uint8_t const* records = static_cast< uint8_t const* >(ply.records(*vertices));
+        vertexData.assign(records, records + (vertexCount * vertices->recordSize));
+    }
+    else {
+        std::vector< int32_t > remap = optimize_vertex_fetch(indices.data(), indices.size(), vertexCount);
+        outputVertices = size_t(std::count_if(remap.begin(), remap.end(), [] (int32_t index) { return index >= 0; }));
+        vertexData.resize(outputVertices * vertices->recordSize);
+        remap_vertices(ply.records(*vertices), vertexCount, vertices->recordSize, remap, vertexData.data());
+        if (outputVertices < vertexCount) {
+            std::printf("dropped %zu unused vertices\n", vertexCount - outputVertices);
+        }
+    }
+
+    bool swap = ply.big_endian() != host_big_endian();
+    std::string header = std::string("ply\nformat ") + (ply.big_endian() ? "binary_big_endian" : "binary_little_endian") + " 1.0\n";
+    header += "comment optimized for a " + std::to_string(cacheSize) + " entry vertex cache\n";
+    header += vertex_header(*vertices, outputVertices);
+
+    std::vector< uint8_t > indexData;
+    if (strip) {
+        start = std::chrono::steady_clock::now();
+        std::vector< int32_t > strips = build_strip(indices.data(), indices.size(), outputVertices);
+        ms = elapsed_ms(start);
+        std::printf("strip:    ACMR %.3f in %.1f ms, %zu indices for %zu in the list\n",
+            cache_miss_ratio(strips.data(), strips.size(), PrimitiveTopology::TriangleStrip, cacheSize), ms, strips.size(), indices.size());
+        header += "element tristrips 1\nproperty list int int vertex_indices\nend_header\n";
+        indexData.reserve((strips.size() + 1) * sizeof(int32_t));
+        append< int32_t >(indexData, int32_t(strips.size()), swap);
+        for (int32_t index : strips) {
+            append< int32_t >(indexData, index, swap);
+        }
+    }
+    else {
+        header += "element face " + std::to_string(indices.size() / 3) + "\nproperty list uchar int vertex_indices\nend_header\n";
+        indexData.reserve((indices.size() / 3) * (1 + (3 * sizeof(int32_t))));
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            append< uint8_t >(indexData, 3, swap);
+            append< int32_t >(indexData, indices[i], swap);
+            append< int32_t >(indexData, indices[i + 1], swap);
+            append< int32_t >(indexData, indices[i + 2], swap);
+        }
+    }
+
+    if (!write_ply(paths[1], header, vertexData, indexData)) {
+        std::fprintf(stderr, "can't write %s\n", paths[1].c_str());
+        return 1;
+    }
+
+    return 0;
+}
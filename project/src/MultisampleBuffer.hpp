@@ -0,0 +1,249 @@
+#ifndef JHSR_MULTISAMPLEBUFFER_HPP
+#define JHSR_MULTISAMPLEBUFFER_HPP
+
+#include "Framebuffer.hpp"
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cassert>
+
+// Colour of a SAMPLES x multisampled target, compressed a TILE_SIZE square
+// tile at a time. A compressed tile stores one colour per pixel, shared by
+// all of the pixel's samples. The first write that gives a pixel's samples
+// different colours expands its tile into per sample storage, where it stays
+// until the next clear. Most tiles never see a triangle edge, so most writes
+// and most of the resolve touch a quarter of the memory they would if every
+// sample was stored.
+//
+// Tiles line up with the renderer's bins, so threads rasterising different
+// bins never touch the same tile.
+class MultisampleBuffer
+{
+public:
+
+	enum : int { SAMPLES = 4, ALL_SAMPLES = (1 << SAMPLES) - 1, TILE_SIZE = Framebuffer::MICRO_TILE_SIZE };
+
+	MultisampleBuffer(size_t width, size_t height, PixelFormat format, FramebufferLayout layout = FramebufferLayout::Linear);
+
+	size_t width() const;
+
+	size_t height() const;
+
+	PixelFormat format() const;
+
+	// Sets every sample to value, one pixel of the buffer's format, and
+	// compresses every tile.
+	void clear(void const* value);
+
+	// Sets the samples of pixel (x, y) in mask, bit i for sample i, to value.
+	// T must be the size of a pixel.
+	template< typename T >
+	void write(size_t x, size_t y, int mask, T const& value);
+
+	// Where a fragment covering the samples in mask is merged, for writes
+	// that read what they overwrite. That is pixel (x, y) itself when its
+	// tile is compressed and mask covers every sample, with mask set to 1,
+	// and otherwise the pixel's SAMPLES samples, one after another, with the
+	// tile expanded first if it was compressed.
+	void* fragment_span(size_t x, size_t y, int& mask);
+
+	void get_sample(size_t x, size_t y, int sample, void* result) const;
+
+	// Whether the tile holding pixel (x, y) is compressed
+	bool compressed(size_t x, size_t y) const;
+
+	// Writes the average of each pixel's samples into rows [y0, y1) of
+	// target, which must match the buffer's size and format. Compressed
+	// tiles are copied, and the rows of different calls can be resolved in
+	// parallel.
+	void resolve(Framebuffer& target, size_t y0, size_t y1) const;
+
+	void resolve(Framebuffer& target) const;
+
+private:
+
+	MultisampleBuffer(MultisampleBuffer const&) = delete;
+	MultisampleBuffer& operator=(MultisampleBuffer const&) = delete;
+
+	size_t tile_index(size_t x, size_t y) const;
+
+	template< typename T >
+	void expand_tile(size_t x0, size_t y0);
+
+	// Resolves count pixels, whose samples are contiguous, into target
+	void resolve_span(void const* samples, void* target, size_t count) const;
+
+	Framebuffer _pixels;
+	Framebuffer _samples;
+	size_t _tilesX;
+	std::vector< uint8_t > _compressed;
+};
+
+// The standard 4x pattern, a rotated grid, in sixteenths of a pixel from the
+// pixel centre. The pattern is usually given with y pointing down, and window
+// y points up, so y is flipped to put the samples in the same place on
+// screen.
+inline glm::ivec2 sample_offset(int sample) {
+	static int const offsets[MultisampleBuffer::SAMPLES][2] = { { -2, -6 }, { 6, -2 }, { -6, 2 }, { 2, 6 } };
+	assert(sample >= 0 && sample < MultisampleBuffer::SAMPLES);
+	return glm::ivec2(offsets[sample][0], -offsets[sample][1]);
+}
+
+
+inline MultisampleBuffer::MultisampleBuffer(size_t width, size_t height, PixelFormat format, FramebufferLayout layout)
+: _pixels(width, height, format, layout),
+  _samples(width, height, SAMPLES * pixel_format_size(format), layout),
+  _tilesX((width + TILE_SIZE - 1) / TILE_SIZE),
+  _compressed(_tilesX * ((height + TILE_SIZE - 1) / TILE_SIZE), 1) {
+	assert(format == PixelFormat::RGBA8 || format == PixelFormat::RGBA32F);
+}
+
+inline size_t MultisampleBuffer::width() const {
+	return _pixels.width();
+}
+
+inline size_t MultisampleBuffer::height() const {
+	return _pixels.height();
+}
+
+inline PixelFormat MultisampleBuffer::format() const {
+	return _pixels.format();
+}
+
+// Expanded tiles keep their stale samples, which nothing reads until a
+// write expands the tile again.
+inline void MultisampleBuffer::clear(void const* value) {
+	_pixels.clear(value);
+	std::fill(_compressed.begin(), _compressed.end(), uint8_t(1));
+}
+
+inline size_t MultisampleBuffer::tile_index(size_t x, size_t y) const {
+	return ((y / TILE_SIZE) * _tilesX) + (x / TILE_SIZE);
+}
+
+template< typename T >
+inline void MultisampleBuffer::write(size_t x, size_t y, int mask, T const& value) {
+	assert(sizeof(T) == _pixels.bytes_per_pixel());
+	assert(mask != 0 && (mask & ~ALL_SAMPLES) == 0);
+	if (_compressed[tile_index(x, y)]) {
+		if (mask == ALL_SAMPLES) {
+			_pixels.pixel< T >(x, y) = value;
+			return;
+		}
+
+		expand_tile< T >(x - (x % TILE_SIZE), y - (y % TILE_SIZE));
+	}
+
+	T* samples = static_cast< T* >(_samples.pixel_address(x, y));
+	for (int i = 0; i < SAMPLES; ++i) {
+		if (mask & (1 << i)) {
+			samples[i] = value;
+		}
+	}
+}
+
+inline void* MultisampleBuffer::fragment_span(size_t x, size_t y, int& mask) {
+	assert(mask != 0 && (mask & ~ALL_SAMPLES) == 0);
+	if (_compressed[tile_index(x, y)]) {
+		if (mask == ALL_SAMPLES) {
+			mask = 1;
+			return _pixels.pixel_address(x, y);
+		}
+
+		if (format() == PixelFormat::RGBA32F) {
+			expand_tile< glm::vec4 >(x - (x % TILE_SIZE), y - (y % TILE_SIZE));
+		}
+		else {
+			expand_tile< uint32_t >(x - (x % TILE_SIZE), y - (y % TILE_SIZE));
+		}
+	}
+
+	return _samples.pixel_address(x, y);
+}
+
+// Rows of a tile are contiguous in either layout
+template< typename T >
+inline void MultisampleBuffer::expand_tile(size_t x0, size_t y0) {
+	size_t x1 = std::min(x0 + TILE_SIZE, width()), y1 = std::min(y0 + TILE_SIZE, height());
+	for (size_t y = y0; y < y1; ++y) {
+		T const* pixels = static_cast< T const* >(_pixels.pixel_address(x0, y));
+		T* samples = static_cast< T* >(_samples.pixel_address(x0, y));
+		for (size_t i = 0; i < x1 - x0; ++i) {
+			for (int j = 0; j < SAMPLES; ++j) {
+				samples[(i * SAMPLES) + j] = pixels[i];
+			}
+		}
+	}
+
+	_compressed[tile_index(x0, y0)] = 0;
+}
+
+inline void MultisampleBuffer::get_sample(size_t x, size_t y, int sample, void* result) const {
+	assert(x < width() && y < height());
+	assert(sample >= 0 && sample < SAMPLES);
+	size_t size = _pixels.bytes_per_pixel();
+	if (compressed(x, y)) {
+		std::memcpy(result, _pixels.pixel_address(x, y), size);
+	}
+	else {
+		std::memcpy(result, static_cast< uint8_t const* >(_samples.pixel_address(x, y)) + (sample * size), size);
+	}
+}
+
+inline bool MultisampleBuffer::compressed(size_t x, size_t y) const {
+	return _compressed[tile_index(x, y)] != 0;
+}
+
+// RGBA8 channels are averaged two at a time, each in 16 bits of a 32-bit
+// sum, rounding to nearest. The floats are summed in pairs, so a pixel whose
+// samples are all equal resolves to exactly that colour in either format.
+inline void MultisampleBuffer::resolve_span(void const* samples, void* target, size_t count) const {
+	if (format() == PixelFormat::RGBA8) {
+		uint32_t const* in = static_cast< uint32_t const* >(samples);
+		uint32_t* out = static_cast< uint32_t* >(target);
+		for (size_t i = 0; i < count; ++i, in += SAMPLES) {
+			uint32_t even = 0, odd = 0;
+			for (int j = 0; j < SAMPLES; ++j) {
+				even += in[j] & 0x00ff00ff;
+				odd += (in[j] >> 8) & 0x00ff00ff;
+			}
+
+			even = ((even + 0x00020002) >> 2) & 0x00ff00ff;
+			odd = ((odd + 0x00020002) >> 2) & 0x00ff00ff;
+			out[i] = even | (odd << 8);
+		}
+	}
+	else {
+		glm::vec4 const* in = static_cast< glm::vec4 const* >(samples);
+		glm::vec4* out = static_cast< glm::vec4* >(target);
+		for (size_t i = 0; i < count; ++i, in += SAMPLES) {
+			out[i] = ((in[0] + in[1]) + (in[2] + in[3])) * 0.25f;
+		}
+	}
+}
+
+inline void MultisampleBuffer::resolve(Framebuffer& target, size_t y0, size_t y1) const {
+	static_assert(SAMPLES == 4, "resolve_span averages four samples");
+	assert(target.width() == width() && target.height() == height());
+	assert(target.format() == format());
+	assert(y0 <= y1 && y1 <= height());
+	size_t size = _pixels.bytes_per_pixel();
+	for (size_t y = y0; y < y1; ++y) {
+		for (size_t x0 = 0; x0 < width(); x0 += TILE_SIZE) {
+			size_t span = std::min(x0 + TILE_SIZE, width()) - x0;
+			if (compressed(x0, y)) {
+				std::memcpy(target.pixel_address(x0, y), _pixels.pixel_address(x0, y), span * size);
+			}
+			else {
+				resolve_span(_samples.pixel_address(x0, y), target.pixel_address(x0, y), span);
+			}
+		}
+	}
+}
+
+inline void MultisampleBuffer::resolve(Framebuffer& target) const {
+	resolve(target, 0, height());
+}
+
+#endif // JHSR_MULTISAMPLEBUFFER_HPP
@@ -0,0 +1,284 @@
+#include "OutputMerger.hpp"
+#include <cassert>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// The bytes of an RGBA8 pixel that the channels in writeMask cover
+static inline uint32_t channel_bytes(int writeMask) {
+	uint32_t bytes = 0;
+	for (int c = 0; c < 4; ++c) {
+		if (writeMask & (1 << c)) {
+			bytes |= 0xffu << (8 * c);
+		}
+	}
+
+	return bytes;
+}
+
+#if defined(__SSE2__)
+
+// Written to do exactly what the scalar path does channel by channel, min and
+// max included, which take their operands in the order that gives NaN the
+// same treatment as std::min and std::max.
+
+static inline __m128 clamp_unit(__m128 v) {
+	return _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+}
+
+static inline __m128 blend_factor(BlendFactor factor, __m128 src, __m128 dst, __m128 constant) {
+	__m128 one = _mm_set1_ps(1.0f);
+	switch (factor) {
+		case BlendFactor::Zero:                  return _mm_setzero_ps();
+		case BlendFactor::One:                   return one;
+		case BlendFactor::SrcColor:              return src;
+		case BlendFactor::OneMinusSrcColor:      return _mm_sub_ps(one, src);
+		case BlendFactor::SrcAlpha:              return _mm_shuffle_ps(src, src, _MM_SHUFFLE(3, 3, 3, 3));
+		case BlendFactor::OneMinusSrcAlpha:      return _mm_sub_ps(one, _mm_shuffle_ps(src, src, _MM_SHUFFLE(3, 3, 3, 3)));
+		case BlendFactor::DstColor:              return dst;
+		case BlendFactor::OneMinusDstColor:      return _mm_sub_ps(one, dst);
+		case BlendFactor::DstAlpha:              return _mm_shuffle_ps(dst, dst, _MM_SHUFFLE(3, 3, 3, 3));
+		case BlendFactor::OneMinusDstAlpha:      return _mm_sub_ps(one, _mm_shuffle_ps(dst, dst, _MM_SHUFFLE(3, 3, 3, 3)));
+		case BlendFactor::ConstantColor:         return constant;
+		default:                                 return _mm_sub_ps(one, constant);
+	}
+}
+
+static inline __m128 blend_equation(BlendFactor srcFactor, BlendFactor dstFactor, BlendOp op, __m128 src, __m128 dst, __m128 constant) {
+	if (op == BlendOp::Min) {
+		return _mm_min_ps(dst, src);
+	}
+
+	if (op == BlendOp::Max) {
+		return _mm_max_ps(dst, src);
+	}
+
+	__m128 s = _mm_mul_ps(src, blend_factor(srcFactor, src, dst, constant));
+	__m128 d = _mm_mul_ps(dst, blend_factor(dstFactor, src, dst, constant));
+	switch (op) {
+		case BlendOp::Add:      return _mm_add_ps(s, d);
+		case BlendOp::Subtract: return _mm_sub_ps(s, d);
+		default:                return _mm_sub_ps(d, s);
+	}
+}
+
+// The alpha equation is only worked out separately when it differs
+static inline __m128 blend_pixel(BlendState const& state, __m128 src, __m128 dst, __m128 constant) {
+	__m128 color = blend_equation(state.srcColor, state.dstColor, state.colorOp, src, dst, constant);
+	if (state.srcAlpha == state.srcColor && state.dstAlpha == state.dstColor && state.alphaOp == state.colorOp) {
+		return color;
+	}
+
+	__m128 alpha = blend_equation(state.srcAlpha, state.dstAlpha, state.alphaOp, src, dst, constant);
+	__m128 alphaLane = _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1));
+	return _mm_or_ps(_mm_and_ps(alphaLane, alpha), _mm_andnot_ps(alphaLane, color));
+}
+
+// Lanes outside the mask read as zero rather than whatever the caller left
+// there, which might be a denormal or NaN that slows every operation down.
+static inline void load_colors(glm::vec4 const* colors, int lanes, __m128* src) {
+	for (int i = 0; i < 4; ++i) {
+		src[i] = (lanes & (1 << i)) ? _mm_loadu_ps(&colors[i][0]) : _mm_setzero_ps();
+	}
+}
+
+static inline __m128i pack_rgba8x4(__m128 const* colors) {
+	__m128 scale = _mm_set1_ps(255.0f), half = _mm_set1_ps(0.5f);
+	__m128i c[4];
+	for (int i = 0; i < 4; ++i) {
+		c[i] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(clamp_unit(colors[i]), scale), half));
+	}
+
+	return _mm_packus_epi16(_mm_packs_epi32(c[0], c[1]), _mm_packs_epi32(c[2], c[3]));
+}
+
+static inline void unpack_rgba8x4(__m128i pixels, __m128* colors) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_unpacklo_epi8(pixels, zero), hi = _mm_unpackhi_epi8(pixels, zero);
+	__m128 scale = _mm_set1_ps(1.0f / 255.0f);
+	colors[0] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale);
+	colors[1] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale);
+	colors[2] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale);
+	colors[3] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale);
+}
+
+static void merge_rgba8(BlendState const& state, uint32_t* target, glm::vec4 const* colors, int lanes) {
+	__m128 src[4];
+	load_colors(colors, lanes, src);
+	__m128i dst = _mm_setzero_si128();
+	if (!state.overwrites()) {
+		if (lanes == 15) {
+			dst = _mm_loadu_si128(reinterpret_cast< __m128i const* >(target));
+		}
+		else {
+			alignas(16) uint32_t pixels[4] = {};
+			for (int i = 0; i < 4; ++i) {
+				if (lanes & (1 << i)) pixels[i] = target[i];
+			}
+
+			dst = _mm_load_si128(reinterpret_cast< __m128i const* >(pixels));
+		}
+	}
+
+	if (state.enabled) {
+		__m128 dstColors[4];
+		unpack_rgba8x4(dst, dstColors);
+		__m128 constant = clamp_unit(_mm_loadu_ps(&state.constant[0]));
+		for (int i = 0; i < 4; ++i) {
+			if (lanes & (1 << i)) src[i] = blend_pixel(state, clamp_unit(src[i]), dstColors[i], constant);
+		}
+	}
+
+	__m128i result = pack_rgba8x4(src);
+	if (state.writeMask != COLOR_WRITE_ALL) {
+		__m128i bytes = _mm_set1_epi32(int(channel_bytes(state.writeMask)));
+		result = _mm_or_si128(_mm_and_si128(bytes, result), _mm_andnot_si128(bytes, dst));
+	}
+
+	if (lanes == 15) {
+		_mm_storeu_si128(reinterpret_cast< __m128i* >(target), result);
+		return;
+	}
+
+	alignas(16) uint32_t pixels[4];
+	_mm_store_si128(reinterpret_cast< __m128i* >(pixels), result);
+	for (int i = 0; i < 4; ++i) {
+		if (lanes & (1 << i)) target[i] = pixels[i];
+	}
+}
+
+static void merge_float(BlendState const& state, glm::vec4* target, glm::vec4 const* colors, int lanes) {
+	__m128 constant = _mm_loadu_ps(&state.constant[0]);
+	__m128 write = _mm_castsi128_ps(_mm_setr_epi32((state.writeMask & COLOR_WRITE_RED) ? -1 : 0, (state.writeMask & COLOR_WRITE_GREEN) ? -1 : 0,
+	                                               (state.writeMask & COLOR_WRITE_BLUE) ? -1 : 0, (state.writeMask & COLOR_WRITE_ALPHA) ? -1 : 0));
+	bool overwrites = state.overwrites();
+	for (int i = 0; i < 4; ++i) {
+		if (!(lanes & (1 << i))) {
+			continue;
+		}
+
+		__m128 src = _mm_loadu_ps(&colors[i][0]);
+		if (!overwrites) {
+			__m128 dst = _mm_loadu_ps(&target[i][0]);
+			if (state.enabled) {
+				src = blend_pixel(state, src, dst, constant);
+			}
+
+			src = _mm_or_ps(_mm_and_ps(write, src), _mm_andnot_ps(write, dst));
+		}
+
+		_mm_storeu_ps(&target[i][0], src);
+	}
+}
+
+#else
+
+static inline glm::vec4 clamp_unit(glm::vec4 const& v) {
+	glm::vec4 result;
+	for (int c = 0; c < 4; ++c) {
+		result[c] = std::min(std::max(0.0f, v[c]), 1.0f);
+	}
+
+	return result;
+}
+
+static inline float blend_factor(BlendFactor factor, glm::vec4 const& src, glm::vec4 const& dst, glm::vec4 const& constant, int c) {
+	switch (factor) {
+		case BlendFactor::Zero:                  return 0.0f;
+		case BlendFactor::One:                   return 1.0f;
+		case BlendFactor::SrcColor:              return src[c];
+		case BlendFactor::OneMinusSrcColor:      return 1.0f - src[c];
+		case BlendFactor::SrcAlpha:              return src[3];
+		case BlendFactor::OneMinusSrcAlpha:      return 1.0f - src[3];
+		case BlendFactor::DstColor:              return dst[c];
+		case BlendFactor::OneMinusDstColor:      return 1.0f - dst[c];
+		case BlendFactor::DstAlpha:              return dst[3];
+		case BlendFactor::OneMinusDstAlpha:      return 1.0f - dst[3];
+		case BlendFactor::ConstantColor:         return constant[c];
+		default:                                 return 1.0f - constant[c];
+	}
+}
+
+static inline glm::vec4 blend_pixel(BlendState const& state, glm::vec4 const& src, glm::vec4 const& dst, glm::vec4 const& constant) {
+	glm::vec4 result;
+	for (int c = 0; c < 4; ++c) {
+		BlendFactor srcFactor = (c < 3) ? state.srcColor : state.srcAlpha;
+		BlendFactor dstFactor = (c < 3) ? state.dstColor : state.dstAlpha;
+		BlendOp op = (c < 3) ? state.colorOp : state.alphaOp;
+		float s = src[c] * blend_factor(srcFactor, src, dst, constant, c);
+		float d = dst[c] * blend_factor(dstFactor, src, dst, constant, c);
+		switch (op) {
+			case BlendOp::Add:             result[c] = s + d; break;
+			case BlendOp::Subtract:        result[c] = s - d; break;
+			case BlendOp::ReverseSubtract: result[c] = d - s; break;
+			case BlendOp::Min:             result[c] = std::min(src[c], dst[c]); break;
+			default:                       result[c] = std::max(src[c], dst[c]); break;
+		}
+	}
+
+	return result;
+}
+
+static inline glm::vec4 unpack_rgba8(uint32_t pixel) {
+	glm::vec4 color;
+	for (int c = 0; c < 4; ++c) {
+		color[c] = float((pixel >> (8 * c)) & 0xff) * (1.0f / 255.0f);
+	}
+
+	return color;
+}
+
+static void merge_rgba8(BlendState const& state, uint32_t* target, glm::vec4 const* colors, int lanes) {
+	uint32_t bytes = channel_bytes(state.writeMask);
+	glm::vec4 constant = clamp_unit(state.constant);
+	for (int i = 0; i < 4; ++i) {
+		if (!(lanes & (1 << i))) {
+			continue;
+		}
+
+		glm::vec4 src = colors[i];
+		if (state.enabled) {
+			src = blend_pixel(state, clamp_unit(src), unpack_rgba8(target[i]), constant);
+		}
+
+		target[i] = (pack_rgba8(src) & bytes) | (target[i] & ~bytes);
+	}
+}
+
+static void merge_float(BlendState const& state, glm::vec4* target, glm::vec4 const* colors, int lanes) {
+	for (int i = 0; i < 4; ++i) {
+		if (!(lanes & (1 << i))) {
+			continue;
+		}
+
+		glm::vec4 src = colors[i];
+		if (state.enabled) {
+			src = blend_pixel(state, src, target[i], state.constant);
+		}
+
+		for (int c = 0; c < 4; ++c) {
+			if (state.writeMask & (1 << c)) target[i][c] = src[c];
+		}
+	}
+}
+
+#endif
+
+void merge_colors(BlendState const& state, PixelFormat format, void* target, glm::vec4 const* colors, int mask) {
+	assert(format == PixelFormat::RGBA8 || format == PixelFormat::RGBA32F || format == PixelFormat::Untyped);
+	assert(mask >= 0);
+	for (int base = 0; (mask >> base) != 0; base += 4) {
+		int lanes = (mask >> base) & 15;
+		if (lanes == 0) {
+			continue;
+		}
+
+		if (format == PixelFormat::RGBA32F) {
+			merge_float(state, static_cast< glm::vec4* >(target) + base, colors + base, lanes);
+		}
+		else {
+			merge_rgba8(state, static_cast< uint32_t* >(target) + base, colors + base, lanes);
+		}
+	}
+}
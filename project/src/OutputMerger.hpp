@@ -0,0 +1,161 @@
+#ifndef JHSR_OUTPUTMERGER_HPP
+#define JHSR_OUTPUTMERGER_HPP
+
+#include "Framebuffer.hpp"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+
+// Compares a fragment's z, on the left, with the stored depth. Less,
+// LessEqual and Equal, and Never, only pass fragments at or in front of the
+// stored depth, which is what the Hi-Z buffer's rejection relies on. Draws
+// with the others rasterise every block of every triangle.
+enum class DepthTest
+{
+	Never,
+	Less,
+	Equal,
+	LessEqual,
+	Greater,
+	NotEqual,
+	GreaterEqual,
+	Always
+};
+
+// What a blend equation scales a colour by. Src is the fragment's colour,
+// Dst the pixel's and Constant the blend state's.
+enum class BlendFactor
+{
+	Zero,
+	One,
+	SrcColor,
+	OneMinusSrcColor,
+	SrcAlpha,
+	OneMinusSrcAlpha,
+	DstColor,
+	OneMinusDstColor,
+	DstAlpha,
+	OneMinusDstAlpha,
+	ConstantColor,
+	OneMinusConstantColor
+};
+
+// Combines the scaled source and destination. Min and Max ignore the factors.
+enum class BlendOp
+{
+	Add,
+	Subtract,
+	ReverseSubtract,
+	Min,
+	Max
+};
+
+// Channels a colour write touches
+enum : int
+{
+	COLOR_WRITE_RED = 1,
+	COLOR_WRITE_GREEN = 2,
+	COLOR_WRITE_BLUE = 4,
+	COLOR_WRITE_ALPHA = 8,
+	COLOR_WRITE_ALL = 15
+};
+
+// How fragment colours are merged into the colour buffer. With blending on,
+//
+//   rgb = (src.rgb * srcColor) colorOp (dst.rgb * dstColor)
+//   a   = (src.a * srcAlpha) alphaOp (dst.a * dstAlpha)
+//
+// and otherwise the fragment's colour replaces the pixel's. Only the channels
+// in writeMask are written either way. RGBA8 targets clamp the fragment
+// colour and constant to [0, 1] before blending, as they clamp the result;
+// RGBA32F targets clamp nothing. The default state overwrites every channel.
+struct BlendState
+{
+	BlendState();
+
+	// src * alpha + dst * (1 - alpha), for non-premultiplied colours
+	static BlendState alpha_blend();
+
+	// Whether merging a colour is a plain overwrite
+	bool overwrites() const;
+
+	bool enabled;
+	BlendFactor srcColor, dstColor;
+	BlendOp colorOp;
+	BlendFactor srcAlpha, dstAlpha;
+	BlendOp alphaOp;
+	glm::vec4 constant;
+	int writeMask;
+};
+
+bool depth_test_passes(DepthTest test, float z, float depth);
+
+// Whether test never passes a fragment behind the stored depth
+bool depth_test_in_front(DepthTest test);
+
+// An RGBA8 pixel, red in the low byte. Channels are clamped to [0, 1] and
+// rounded to nearest.
+uint32_t pack_rgba8(glm::vec4 const& color);
+
+// Merges colors[i] into pixel i of the contiguous span at target for every
+// bit i of mask, in a target of the given format: RGBA32F, or four bytes per
+// pixel taken as RGBA8. Four pixels are converted and blended at a time, and
+// when the state overwrites, nothing is read back from the target.
+void merge_colors(BlendState const& state, PixelFormat format, void* target, glm::vec4 const* colors, int mask);
+
+
+inline BlendState::BlendState()
+: enabled(false),
+  srcColor(BlendFactor::One),
+  dstColor(BlendFactor::Zero),
+  colorOp(BlendOp::Add),
+  srcAlpha(BlendFactor::One),
+  dstAlpha(BlendFactor::Zero),
+  alphaOp(BlendOp::Add),
+  constant(0.0f),
+  writeMask(COLOR_WRITE_ALL) {
+
+}
+
+inline BlendState BlendState::alpha_blend() {
+	BlendState state;
+	state.enabled = true;
+	state.srcColor = BlendFactor::SrcAlpha;
+	state.dstColor = BlendFactor::OneMinusSrcAlpha;
+	state.srcAlpha = BlendFactor::One;
+	state.dstAlpha = BlendFactor::OneMinusSrcAlpha;
+	return state;
+}
+
+inline bool BlendState::overwrites() const {
+	return !enabled && writeMask == COLOR_WRITE_ALL;
+}
+
+inline bool depth_test_passes(DepthTest test, float z, float depth) {
+	switch (test) {
+		case DepthTest::Never:        return false;
+		case DepthTest::Less:         return z < depth;
+		case DepthTest::Equal:        return z == depth;
+		case DepthTest::LessEqual:    return z <= depth;
+		case DepthTest::Greater:      return z > depth;
+		case DepthTest::NotEqual:     return z != depth;
+		case DepthTest::GreaterEqual: return z >= depth;
+		default:                      return true;
+	}
+}
+
+inline bool depth_test_in_front(DepthTest test) {
+	return test == DepthTest::Never || test == DepthTest::Less || test == DepthTest::Equal || test == DepthTest::LessEqual;
+}
+
+// max(0, c) rather than max(c, 0) sends NaN to 0, as SSE's maxps does
+inline uint32_t pack_rgba8(glm::vec4 const& color) {
+	uint32_t pixel = 0;
+	for (int c = 0; c < 4; ++c) {
+		pixel |= uint32_t((std::min(std::max(0.0f, color[c]), 1.0f) * 255.0f) + 0.5f) << (8 * c);
+	}
+
+	return pixel;
+}
+
+#endif // JHSR_OUTPUTMERGER_HPP
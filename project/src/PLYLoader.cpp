@@ -0,0 +1,677 @@
+#include "PLYLoader.hpp"
+#include "MeshOptimizer.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sstream>
+#include <limits>
+#include <cerrno>
+#include <cstring>
+#include <cassert>
+
+static inline bool host_big_endian() {
+	uint16_t one = 1;
+	uint8_t first;
+	std::memcpy(&first, &one, 1);
+	return first == 0;
+}
+
+// Values are copied out byte by byte, as nothing in a PLY file is aligned
+template< typename T >
+static inline T load(uint8_t const* p, bool swap) {
+	uint8_t bytes[sizeof(T)];
+	std::memcpy(bytes, p, sizeof(T));
+	if (swap) {
+		std::reverse(bytes, bytes + sizeof(T));
+	}
+
+	T value;
+	std::memcpy(&value, bytes, sizeof(T));
+	return value;
+}
+
+static double load_scalar(uint8_t const* p, PLYLoader::Type type, bool swap) {
+	switch (type) {
+		case PLYLoader::Type::Int8:    return load< int8_t >(p, swap);
+		case PLYLoader::Type::UInt8:   return load< uint8_t >(p, swap);
+		case PLYLoader::Type::Int16:   return load< int16_t >(p, swap);
+		case PLYLoader::Type::UInt16:  return load< uint16_t >(p, swap);
+		case PLYLoader::Type::Int32:   return load< int32_t >(p, swap);
+		case PLYLoader::Type::UInt32:  return load< uint32_t >(p, swap);
+		case PLYLoader::Type::Float32: return load< float >(p, swap);
+		default:                       return load< double >(p, swap);
+	}
+}
+
+// List counts and indices. Float ones, which the format allows, are
+// truncated.
+static int64_t load_integer(uint8_t const* p, PLYLoader::Type type, bool swap) {
+	switch (type) {
+		case PLYLoader::Type::Int8:   return load< int8_t >(p, swap);
+		case PLYLoader::Type::UInt8:  return load< uint8_t >(p, swap);
+		case PLYLoader::Type::Int16:  return load< int16_t >(p, swap);
+		case PLYLoader::Type::UInt16: return load< uint16_t >(p, swap);
+		case PLYLoader::Type::Int32:  return load< int32_t >(p, swap);
+		case PLYLoader::Type::UInt32: return load< uint32_t >(p, swap);
+		default:                      return int64_t(load_scalar(p, type, swap));
+	}
+}
+
+// Loads count indices of type T into indices, checking each is in
+// [0, limit)
+template< typename T >
+static inline bool load_indices(uint8_t const* p, size_t count, bool swap, int64_t limit, int32_t* indices) {
+	for (size_t k = 0; k < count; ++k, p += sizeof(T)) {
+		int64_t index = int64_t(load< T >(p, swap));
+		if (index < 0 || index >= limit) {
+			return false;
+		}
+
+		indices[k] = int32_t(index);
+	}
+
+	return true;
+}
+
+static bool parse_type(std::string const& name, PLYLoader::Type& type) {
+	static struct { char const* name; PLYLoader::Type type; } const types[] = {
+		{ "char", PLYLoader::Type::Int8 }, { "int8", PLYLoader::Type::Int8 },
+		{ "uchar", PLYLoader::Type::UInt8 }, { "uint8", PLYLoader::Type::UInt8 },
+		{ "short", PLYLoader::Type::Int16 }, { "int16", PLYLoader::Type::Int16 },
+		{ "ushort", PLYLoader::Type::UInt16 }, { "uint16", PLYLoader::Type::UInt16 },
+		{ "int", PLYLoader::Type::Int32 }, { "int32", PLYLoader::Type::Int32 },
+		{ "uint", PLYLoader::Type::UInt32 }, { "uint32", PLYLoader::Type::UInt32 },
+		{ "float", PLYLoader::Type::Float32 }, { "float32", PLYLoader::Type::Float32 },
+		{ "double", PLYLoader::Type::Float64 }, { "float64", PLYLoader::Type::Float64 }
+	};
+
+	for (auto const& t : types) {
+		if (name == t.name) {
+			type = t.type;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Steps offset over the property of the record at offset, or returns false
+// if it runs past size
+static bool skip_property(PLYLoader::Property const& property, uint8_t const* data, size_t size, size_t& offset, bool swap) {
+	size_t count = 1;
+	if (property.list) {
+		size_t countSize = ply_type_size(property.countType);
+		if (size - offset < countSize) {
+			return false;
+		}
+
+		int64_t n = load_integer(data + offset, property.countType, swap);
+		offset += countSize;
+		if (n < 0) {
+			return false;
+		}
+
+		count = size_t(n);
+	}
+
+	size_t valueSize = ply_type_size(property.type);
+	if (count > (size - offset) / valueSize) {
+		return false;
+	}
+
+	offset += count * valueSize;
+	return true;
+}
+
+size_t ply_type_size(PLYLoader::Type type) {
+	switch (type) {
+		case PLYLoader::Type::Int8:
+		case PLYLoader::Type::UInt8:   return 1;
+		case PLYLoader::Type::Int16:
+		case PLYLoader::Type::UInt16:  return 2;
+		case PLYLoader::Type::Int32:
+		case PLYLoader::Type::UInt32:
+		case PLYLoader::Type::Float32: return 4;
+		default:                       return 8;
+	}
+}
+
+char const* ply_type_name(PLYLoader::Type type) {
+	switch (type) {
+		case PLYLoader::Type::Int8:    return "char";
+		case PLYLoader::Type::UInt8:   return "uchar";
+		case PLYLoader::Type::Int16:   return "short";
+		case PLYLoader::Type::UInt16:  return "ushort";
+		case PLYLoader::Type::Int32:   return "int";
+		case PLYLoader::Type::UInt32:  return "uint";
+		case PLYLoader::Type::Float32: return "float";
+		default:                       return "double";
+	}
+}
+
+PLYLoader::PLYLoader()
+: _data(nullptr),
+  _size(0),
+  _headerSize(0),
+  _bigEndian(false),
+  _streaming(false) {
+
+}
+
+PLYLoader::~PLYLoader() {
+	close();
+}
+
+bool PLYLoader::open(std::string const& path, bool streaming) {
+	close();
+	_error.clear();
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return fail("can't open " + path + ": " + std::strerror(errno));
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		::close(fd);
+		return fail(path + " is empty or unreadable");
+	}
+
+	// The mapping keeps the file open
+	void* data = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED) {
+		return fail("can't map " + path + ": " + std::strerror(errno));
+	}
+
+	_data = static_cast< uint8_t const* >(data);
+	_size = size_t(info.st_size);
+	_streaming = streaming;
+	if (!parse_header() || !locate_elements()) {
+		std::string error = _error;
+		close();
+		_error = error;
+		return false;
+	}
+
+	// Reads the body in the background, so the first draws mostly find it
+	// in memory already
+	if (!_streaming) {
+		advise(_headerSize, _size, MADV_WILLNEED);
+	}
+
+	return true;
+}
+
+void PLYLoader::close() {
+	if (_data != nullptr) {
+		munmap(const_cast< uint8_t* >(_data), _size);
+	}
+
+	_data = nullptr;
+	_size = 0;
+	_headerSize = 0;
+	_elements.clear();
+}
+
+PLYLoader::Element const* PLYLoader::element(char const* name) const {
+	for (Element const& element : _elements) {
+		if (element.name == name) {
+			return &element;
+		}
+	}
+
+	return nullptr;
+}
+
+bool PLYLoader::vertex_view(char const* property, int components, VertexArray& view) const {
+	assert(components >= 1 && components <= 4);
+	Element const* vertices = element("vertex");
+	if (vertices == nullptr || vertices->recordSize == 0 || _bigEndian != host_big_endian()) {
+		return false;
+	}
+
+	// Properties of a record without lists are packed, so consecutive floats
+	// are contiguous
+	int first = find_property(*vertices, property);
+	if (first < 0 || first + components > int(vertices->properties.size())) {
+		return false;
+	}
+
+	for (int c = 0; c < components; ++c) {
+		if (vertices->properties[first + c].type != Type::Float32) {
+			return false;
+		}
+	}
+
+	uint8_t const* start = _data + vertices->offset + vertices->properties[first].offset;
+	view = VertexArray(components, vertices->recordSize - (components * sizeof(float)), const_cast< uint8_t* >(start));
+	view.elementSize = sizeof(float);
+	return true;
+}
+
+bool PLYLoader::read_vertices(char const* const* properties, int components, size_t first, size_t count, float* out) {
+	assert(components >= 1);
+	Element const* vertices = element("vertex");
+	if (vertices == nullptr) {
+		return fail("no vertex element");
+	}
+
+	if (vertices->recordSize == 0) {
+		return fail("vertex element has list properties");
+	}
+
+	assert(first <= vertices->count && count <= vertices->count - first);
+	std::vector< Property const* > read(components);
+	for (int c = 0; c < components; ++c) {
+		int index = find_property(*vertices, properties[c]);
+		if (index < 0) {
+			return fail(std::string("no vertex property ") + properties[c]);
+		}
+
+		read[c] = &vertices->properties[index];
+	}
+
+	bool swap = _bigEndian != host_big_endian();
+	uint8_t const* record = _data + vertices->offset + (first * vertices->recordSize);
+	for (size_t i = 0; i < count; ++i, record += vertices->recordSize) {
+		for (int c = 0; c < components; ++c) {
+			*out++ = float(load_scalar(record + read[c]->offset, read[c]->type, swap));
+		}
+	}
+
+	return true;
+}
+
+// Visits the vertex indices of every face, with the offset of the data
+// after it, as visit(polygon, count, offset). Each polygon is triangulated
+// as a fan around its first vertex, which keeps its winding.
+template< typename Visit >
+bool PLYLoader::read_polygons(Visit const& visit) {
+	Element const* faces = element("face");
+	if (faces == nullptr) {
+		return fail("no face element");
+	}
+
+	int list = find_property(*faces, "vertex_indices");
+	if (list < 0) {
+		list = find_property(*faces, "vertex_index");
+	}
+
+	if (list < 0 || !faces->properties[list].list) {
+		return fail("face element has no vertex_indices list");
+	}
+
+	if (_streaming) {
+		advise(faces->offset, _size, MADV_SEQUENTIAL);
+	}
+
+	bool read;
+	switch (faces->properties[list].type) {
+		case Type::Int8:    read = read_polygons< int8_t >(*faces, list, visit); break;
+		case Type::UInt8:   read = read_polygons< uint8_t >(*faces, list, visit); break;
+		case Type::Int16:   read = read_polygons< int16_t >(*faces, list, visit); break;
+		case Type::UInt16:  read = read_polygons< uint16_t >(*faces, list, visit); break;
+		case Type::Int32:   read = read_polygons< int32_t >(*faces, list, visit); break;
+		case Type::UInt32:  read = read_polygons< uint32_t >(*faces, list, visit); break;
+		case Type::Float32: read = read_polygons< float >(*faces, list, visit); break;
+		default:            read = read_polygons< double >(*faces, list, visit); break;
+	}
+
+	if (_streaming) {
+		advise(faces->offset, _size, MADV_DONTNEED);
+	}
+
+	return read;
+}
+
+// Instantiated for each index type, which keeps the type dispatch out of the
+// loop over faces
+template< typename Index, typename Visit >
+bool PLYLoader::read_polygons(Element const& faces, int list, Visit const& visit) {
+	Element const* vertices = element("vertex");
+	int64_t limit = std::min< int64_t >(vertices ? int64_t(vertices->count) : 0, int64_t(std::numeric_limits< int32_t >::max()) + 1);
+	Property const& indexList = faces.properties[list];
+	size_t countSize = ply_type_size(indexList.countType);
+	bool packed = faces.properties.size() == 1 && indexList.countType == Type::UInt8;
+	bool swap = _bigEndian != host_big_endian();
+	std::vector< int32_t > polygon;
+	size_t offset = faces.offset;
+	for (size_t i = 0; i < faces.count; ++i) {
+		// The usual layout, a uchar count and the indices and nothing else,
+		// reads triangles without the general path's bookkeeping
+		if (packed && offset < _size && _data[offset] == 3 && _size - offset > 3 * sizeof(Index)) {
+			uint8_t const* p = _data + offset + 1;
+			int64_t a = int64_t(load< Index >(p, swap));
+			int64_t b = int64_t(load< Index >(p + sizeof(Index), swap));
+			int64_t c = int64_t(load< Index >(p + (2 * sizeof(Index)), swap));
+			if (uint64_t(a) >= uint64_t(limit) || uint64_t(b) >= uint64_t(limit) || uint64_t(c) >= uint64_t(limit)) {
+				return fail("face " + std::to_string(i) + " has a vertex index out of range");
+			}
+
+			int32_t triangle[] = { int32_t(a), int32_t(b), int32_t(c) };
+			offset += 1 + (3 * sizeof(Index));
+			visit(triangle, 3, offset);
+			continue;
+		}
+
+		for (size_t p = 0; p < faces.properties.size(); ++p) {
+			if (int(p) != list) {
+				if (!skip_property(faces.properties[p], _data, _size, offset, swap)) {
+					return fail("face element runs past the end of the file");
+				}
+
+				continue;
+			}
+
+			int64_t n = (_size - offset < countSize) ? -1 : load_integer(_data + offset, indexList.countType, swap);
+			offset += countSize;
+			if (n < 0 || uint64_t(n) > (_size - offset) / sizeof(Index)) {
+				return fail("face element runs past the end of the file");
+			}
+
+			if (polygon.size() < size_t(n)) {
+				polygon.resize(size_t(n));
+			}
+
+			if (!load_indices< Index >(_data + offset, size_t(n), swap, limit, polygon.data())) {
+				return fail("face " + std::to_string(i) + " has a vertex index out of range");
+			}
+
+			offset += size_t(n) * sizeof(Index);
+			visit(polygon.data(), size_t(n), offset);
+		}
+	}
+
+	return true;
+}
+
+bool PLYLoader::read_faces(std::vector< int32_t >& indices) {
+	indices.clear();
+	indices.reserve(face_count() * 3);
+	return read_polygons([&indices] (int32_t const* polygon, size_t count, size_t) {
+		for (size_t k = 2; k < count; ++k) {
+			indices.push_back(polygon[0]);
+			indices.push_back(polygon[k - 1]);
+			indices.push_back(polygon[k]);
+		}
+	});
+}
+
+// Strips are rare and small, so they are read a value at a time. The end of
+// a list ends a strip as -1 does, and strips of fewer than three vertices
+// are dropped.
+bool PLYLoader::read_strips(std::vector< int32_t >& strip) {
+	strip.clear();
+	Element const* strips = element("tristrips");
+	if (strips == nullptr) {
+		return fail("no tristrips element");
+	}
+
+	int list = find_property(*strips, "vertex_indices");
+	if (list < 0 || !strips->properties[list].list) {
+		return fail("tristrips element has no vertex_indices list");
+	}
+
+	int64_t limit = std::min< int64_t >(vertex_count(), int64_t(std::numeric_limits< int32_t >::max()) + 1);
+	Property const& indexList = strips->properties[list];
+	size_t countSize = ply_type_size(indexList.countType), indexSize = ply_type_size(indexList.type);
+	bool swap = _bigEndian != host_big_endian();
+	std::vector< int32_t > current;
+	size_t offset = strips->offset;
+	for (size_t i = 0; i < strips->count; ++i) {
+		for (size_t p = 0; p < strips->properties.size(); ++p) {
+			if (int(p) != list) {
+				if (!skip_property(strips->properties[p], _data, _size, offset, swap)) {
+					return fail("tristrips element runs past the end of the file");
+				}
+
+				continue;
+			}
+
+			int64_t n = (_size - offset < countSize) ? -1 : load_integer(_data + offset, indexList.countType, swap);
+			offset += countSize;
+			if (n < 0 || uint64_t(n) > (_size - offset) / indexSize) {
+				return fail("tristrips element runs past the end of the file");
+			}
+
+			for (int64_t k = 0; k <= n; ++k) {
+				int64_t index = -1;
+				if (k < n) {
+					index = load_integer(_data + offset, indexList.type, swap);
+					offset += indexSize;
+				}
+
+				if (index < -1 || index >= limit) {
+					return fail("strip " + std::to_string(i) + " has a vertex index out of range");
+				}
+
+				if (index >= 0) {
+					current.push_back(int32_t(index));
+					continue;
+				}
+
+				if (current.size() >= 3) {
+					append_strip(strip, current.data(), current.size());
+				}
+
+				current.clear();
+			}
+		}
+	}
+
+	return true;
+}
+
+void PLYLoader::stream_vertices(size_t chunkVertices, VertexFunc const& visit) {
+	assert(chunkVertices > 0);
+	Element const* vertices = element("vertex");
+	if (vertices == nullptr) {
+		return;
+	}
+
+	for (size_t first = 0; first < vertices->count; first += chunkVertices) {
+		size_t count = std::min(chunkVertices, vertices->count - first);
+		size_t begin = vertices->offset + (first * vertices->recordSize);
+		size_t end = begin + (count * vertices->recordSize);
+		if (_streaming && vertices->recordSize != 0) {
+			advise(begin, end, MADV_WILLNEED);
+		}
+
+		visit(first, count);
+		if (_streaming && vertices->recordSize != 0) {
+			advise(begin, end, MADV_DONTNEED);
+		}
+	}
+}
+
+bool PLYLoader::stream_faces(size_t chunkIndices, IndexFunc const& visit) {
+	assert(chunkIndices >= 3);
+	chunkIndices -= chunkIndices % 3;
+	std::vector< int32_t > chunk;
+	chunk.reserve(chunkIndices);
+	Element const* faces = element("face");
+	size_t visited = faces ? faces->offset : 0;
+	bool read = read_polygons([&] (int32_t const* polygon, size_t count, size_t offset) {
+		for (size_t k = 2; k < count; ++k) {
+			if (chunk.size() == chunkIndices) {
+				visit(chunk.data(), chunk.size());
+				chunk.clear();
+				if (_streaming) {
+					advise(visited, offset, MADV_DONTNEED);
+					visited = offset;
+				}
+			}
+
+			chunk.push_back(polygon[0]);
+			chunk.push_back(polygon[k - 1]);
+			chunk.push_back(polygon[k]);
+		}
+	});
+
+	if (read && !chunk.empty()) {
+		visit(chunk.data(), chunk.size());
+	}
+
+	return read;
+}
+
+bool PLYLoader::fail(std::string const& message) {
+	_error = message;
+	return false;
+}
+
+// The header is text, a keyword and its arguments per line, from "ply" up to
+// and including "end_header"
+bool PLYLoader::parse_header() {
+	size_t offset = 0;
+	bool format = false;
+	for (int line = 0; ; ++line) {
+		uint8_t const* end = static_cast< uint8_t const* >(std::memchr(_data + offset, '\n', _size - offset));
+		if (end == nullptr) {
+			return fail("header has no end_header");
+		}
+
+		std::string text(reinterpret_cast< char const* >(_data + offset), end - (_data + offset));
+		offset = (end - _data) + 1;
+		if (!text.empty() && text.back() == '\r') {
+			text.pop_back();
+		}
+
+		std::istringstream tokens(text);
+		std::string keyword;
+		tokens >> keyword;
+		if (line == 0) {
+			if (keyword != "ply") {
+				return fail("not a PLY file");
+			}
+		}
+		else if (keyword == "format") {
+			std::string encoding;
+			tokens >> encoding;
+			if (encoding == "binary_little_endian" || encoding == "binary_big_endian") {
+				_bigEndian = encoding == "binary_big_endian";
+				format = true;
+			}
+			else if (encoding == "ascii") {
+				return fail("ASCII PLY isn't supported, only binary");
+			}
+			else {
+				return fail("unknown format " + encoding);
+			}
+		}
+		else if (keyword == "element") {
+			Element element;
+			element.recordSize = 0;
+			element.offset = 0;
+			if (!(tokens >> element.name >> element.count)) {
+				return fail("bad element line: " + text);
+			}
+
+			_elements.push_back(element);
+		}
+		else if (keyword == "property") {
+			Property property;
+			std::string type;
+			tokens >> type;
+			property.list = type == "list";
+			property.countType = Type::UInt8;
+			property.offset = 0;
+			if (property.list) {
+				std::string countType;
+				tokens >> countType >> type;
+				if (!parse_type(countType, property.countType) || property.countType == Type::Float32 || property.countType == Type::Float64) {
+					return fail("bad list count type: " + text);
+				}
+			}
+
+			if (!parse_type(type, property.type) || !(tokens >> property.name)) {
+				return fail("bad property line: " + text);
+			}
+
+			if (_elements.empty()) {
+				return fail("property before any element: " + text);
+			}
+
+			_elements.back().properties.push_back(property);
+		}
+		else if (keyword == "end_header") {
+			break;
+		}
+		else if (keyword != "comment" && keyword != "obj_info" && !keyword.empty()) {
+			return fail("unknown header line: " + text);
+		}
+	}
+
+	if (!format) {
+		return fail("header has no format");
+	}
+
+	_headerSize = offset;
+	for (Element& element : _elements) {
+		size_t recordSize = 0;
+		bool lists = false;
+		for (Property& property : element.properties) {
+			property.offset = recordSize;
+			recordSize += ply_type_size(property.type);
+			lists = lists || property.list;
+		}
+
+		element.recordSize = lists ? 0 : recordSize;
+		if (lists) {
+			for (Property& property : element.properties) {
+				property.offset = 0;
+			}
+		}
+	}
+
+	return true;
+}
+
+// The last element's records, usually the faces, are bounds checked as they
+// are read instead
+bool PLYLoader::locate_elements() {
+	bool swap = _bigEndian != host_big_endian();
+	size_t offset = _headerSize;
+	for (Element& element : _elements) {
+		element.offset = offset;
+		if (element.recordSize != 0) {
+			if (element.count > (_size - offset) / element.recordSize) {
+				return fail(element.name + " element runs past the end of the file");
+			}
+
+			offset += element.count * element.recordSize;
+		}
+		else if (&element != &_elements.back()) {
+			for (size_t i = 0; i < element.count; ++i) {
+				for (Property const& property : element.properties) {
+					if (!skip_property(property, _data, _size, offset, swap)) {
+						return fail(element.name + " element runs past the end of the file");
+					}
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+int PLYLoader::find_property(Element const& element, char const* name) const {
+	for (size_t i = 0; i < element.properties.size(); ++i) {
+		if (element.properties[i].name == name) {
+			return int(i);
+		}
+	}
+
+	return -1;
+}
+
+void PLYLoader::advise(size_t begin, size_t end, int advice) const {
+	size_t page = size_t(sysconf(_SC_PAGESIZE));
+	begin -= begin % page;
+	end = std::min(end, _size);
+	if (begin < end) {
+		madvise(const_cast< uint8_t* >(_data) + begin, end - begin, advice);
+	}
+}
@@ -0,0 +1,194 @@
+#ifndef JHSR_PLYLOADER_HPP
+#define JHSR_PLYLOADER_HPP
+
+#include "VertexArray.hpp"
+#include <functional>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Reads binary PLY files, little or big endian, by mapping them into memory
+// rather than reading them. Nothing but the header is parsed when a file is
+// opened. Vertex properties that are floats in the host's byte order are
+// bound in place, as a view straight into the mapping that set_attribute
+// takes as it is:
+//
+//   PLYLoader ply;
+//   VertexArray positions;
+//   if (ply.open("scan.ply") && ply.vertex_view("x", 3, positions)) {
+//       renderer.set_attribute(0, positions.components, positions.stride, positions.vertices);
+//   }
+//
+// Anything else is converted to floats by read_vertices. Faces are
+// triangulated as fans into an index buffer for draw_indexed, in one go or
+// a chunk at a time, and files that hold triangle strips instead are read
+// as one strip.
+//
+// A file opened for streaming is only read where it is used, and the
+// stream_ functions drop the pages of each chunk once it has been visited,
+// so meshes larger than memory can be drawn through a bounded amount of it.
+// Otherwise the whole file is read ahead as soon as it is opened.
+//
+// Failures that come from the file, from a missing file to indices out of
+// range, return false with error() saying what went wrong.
+class PLYLoader
+{
+public:
+
+	enum class Type
+	{
+		Int8,
+		UInt8,
+		Int16,
+		UInt16,
+		Int32,
+		UInt32,
+		Float32,
+		Float64
+	};
+
+	// offset is the property's byte offset in a record of an element without
+	// lists, and 0 otherwise. countType is only meaningful for lists.
+	struct Property
+	{
+		std::string name;
+		Type type;
+		bool list;
+		Type countType;
+		size_t offset;
+	};
+
+	// recordSize is 0 for elements with lists, whose records vary in size.
+	// offset is where the element's records start in the file.
+	struct Element
+	{
+		std::string name;
+		size_t count;
+		std::vector< Property > properties;
+		size_t recordSize;
+		size_t offset;
+	};
+
+	// Visits count vertices from first on
+	typedef std::function< void (size_t first, size_t count) > VertexFunc;
+
+	// Visits count indices, three to a triangle
+	typedef std::function< void (int32_t const* indices, size_t count) > IndexFunc;
+
+	PLYLoader();
+
+	~PLYLoader();
+
+	// Maps path and parses its header, closing any file already open
+	bool open(std::string const& path, bool streaming = false);
+
+	void close();
+
+	std::string const& error() const;
+
+	bool big_endian() const;
+
+	std::vector< Element > const& elements() const;
+
+	// nullptr when the file has no element called name
+	Element const* element(char const* name) const;
+
+	size_t vertex_count() const;
+
+	size_t face_count() const;
+
+	// Where element's records start in the mapped file
+	void const* records(Element const& element) const;
+
+	// A view of components consecutive properties of every vertex, starting
+	// with the one called property, into the mapped file. There's only a
+	// view when they are all floats in the host's byte order, and it's valid
+	// until the file is closed.
+	bool vertex_view(char const* property, int components, VertexArray& view) const;
+
+	// Converts the named properties of vertices [first, first + count), of
+	// any scalar type, to floats, components to a vertex, into out.
+	bool read_vertices(char const* const* properties, int components, size_t first, size_t count, float* out);
+
+	// Triangulates every face into indices, which are replaced
+	bool read_faces(std::vector< int32_t >& indices);
+
+	// Reads the tristrips element, lists of strips each ended by -1, into
+	// strip as one strip for PrimitiveTopology::TriangleStrip, joined as
+	// build_strip joins them
+	bool read_strips(std::vector< int32_t >& strip);
+
+	// Visits the vertices chunkVertices at a time
+	void stream_vertices(size_t chunkVertices, VertexFunc const& visit);
+
+	// Triangulates the faces, visiting at most chunkIndices indices at a
+	// time. Chunks hold whole triangles, so each can be drawn on its own.
+	bool stream_faces(size_t chunkIndices, IndexFunc const& visit);
+
+private:
+
+	PLYLoader(PLYLoader const&) = delete;
+	PLYLoader& operator=(PLYLoader const&) = delete;
+
+	bool fail(std::string const& message);
+
+	bool parse_header();
+
+	template< typename Visit >
+	bool read_polygons(Visit const& visit);
+
+	template< typename Index, typename Visit >
+	bool read_polygons(Element const& faces, int list, Visit const& visit);
+
+	// Finds where every element starts, walking the records of any with
+	// lists that come before others
+	bool locate_elements();
+
+	// Where the property called name is in element, or -1
+	int find_property(Element const& element, char const* name) const;
+
+	// Advises the kernel about the pages under [begin, end) of the file
+	void advise(size_t begin, size_t end, int advice) const;
+
+	uint8_t const* _data;
+	size_t _size;
+	size_t _headerSize;
+	bool _bigEndian;
+	bool _streaming;
+	std::vector< Element > _elements;
+	std::string _error;
+};
+
+size_t ply_type_size(PLYLoader::Type type);
+
+// The type's name in a header
+char const* ply_type_name(PLYLoader::Type type);
+
+
+inline std::string const& PLYLoader::error() const {
+	return _error;
+}
+
+inline bool PLYLoader::big_endian() const {
+	return _bigEndian;
+}
+
+inline std::vector< PLYLoader::Element > const& PLYLoader::elements() const {
+	return _elements;
+}
+
+inline size_t PLYLoader::vertex_count() const {
+	Element const* vertices = element("vertex");
+	return vertices ? vertices->count : 0;
+}
+
+inline size_t PLYLoader::face_count() const {
+	Element const* faces = element("face");
+	return faces ? faces->count : 0;
+}
+
+inline void const* PLYLoader::records(Element const& element) const {
+	return _data + element.offset;
+}
+
+#endif // JHSR_PLYLOADER_HPP
@@ -0,0 +1,288 @@
+#ifndef JHSR_PIPELINE_HPP
+#define JHSR_PIPELINE_HPP
+
+#include "Renderer.hpp"
+#include "TriangleSetup.hpp"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <type_traits>
+#include <cstring>
+#include <cstdint>
+
+// Depth state of a specialised draw, fixed at compile time. DrawState<> is
+// what RenderMode::Forward does with the default depth state.
+template< DepthTest Test = DepthTest::LessEqual, bool DepthWrite = true, bool ColorWrite = true >
+struct DrawState
+{
+	static constexpr DepthTest depthTest = Test;
+	static constexpr bool depthWrite = DepthWrite;
+	static constexpr bool colorWrite = ColorWrite;
+};
+
+// The varyings of a specialised pipeline are a struct of floats, glm vectors
+// included, declared by the shaders' signatures:
+//
+//   glm::vec4 VS::operator()(size_t vindex, VertexArray* attributes, Varyings& out) const;
+//   glm::vec4 FS::operator()(Varyings const& in) const;
+//
+// The vertex shader returns the clip space position and fills out, and the
+// fragment shader returns the colour. Functors and non-generic lambdas both
+// work, and uniforms are whatever the functor holds. Vertex shaders that want
+// the instance being drawn take it after the vertex index:
+//
+//   glm::vec4 VS::operator()(size_t vindex, size_t instance, VertexArray* attributes, Varyings& out) const;
+template< typename VS >
+struct vertex_varyings : vertex_varyings< decltype(&VS::operator()) > {};
+
+template< typename C, typename V >
+struct vertex_varyings< glm::vec4 (C::*) (size_t, VertexArray*, V&) const >
+{
+	typedef V type;
+};
+
+template< typename C, typename V >
+struct vertex_varyings< glm::vec4 (C::*) (size_t, size_t, VertexArray*, V&) const >
+{
+	typedef V type;
+};
+
+template< typename VS, typename V >
+inline auto call_vertex_shader(VS const& vs, size_t vindex, size_t instance, VertexArray* attributes, V& out) -> decltype(vs(vindex, instance, attributes, out)) {
+	return vs(vindex, instance, attributes, out);
+}
+
+template< typename VS, typename V >
+inline auto call_vertex_shader(VS const& vs, size_t vindex, size_t, VertexArray* attributes, V& out) -> decltype(vs(vindex, attributes, out)) {
+	return vs(vindex, attributes, out);
+}
+
+template< typename FS >
+struct fragment_varyings : fragment_varyings< decltype(&FS::operator()) > {};
+
+template< typename C, typename V >
+struct fragment_varyings< glm::vec4 (C::*) (V const&) const >
+{
+	typedef V type;
+};
+
+// Draws with shaders and state known at compile time, so the shaders are
+// inlined into a traversal loop instantiated for the pipeline, varyings are
+// interpolated by fully unrolled loops and the depth test and write masks
+// cost nothing when they are off. Everything else, from vertex caching and
+// clipping to binning and Hi-Z, is the renderer's, and the output is bit for
+// bit what the function pointer path gives the same shaders.
+//
+//   Pipeline::draw< DrawState< DepthTest::Less > >(renderer, vs, fs, 0, count);
+//
+// The draw ignores the render mode, the depth state and the current shaders
+// and rasteriser, and leaves them as they were. Colours are merged with the
+// renderer's blend state. Fragment shaders don't get derivatives, and the
+// target must not be multisampled.
+class Pipeline
+{
+public:
+
+	template< typename State = DrawState<>, typename VS, typename FS >
+	static void draw(Renderer& renderer, VS const& vs, FS const& fs, size_t start, size_t num);
+
+	template< typename State = DrawState<>, typename VS, typename FS >
+	static void draw_indexed(Renderer& renderer, VS const& vs, FS const& fs, size_t start, size_t num, int32_t* indices);
+
+	// See Renderer::draw_instanced
+	template< typename State = DrawState<>, typename VS, typename FS >
+	static void draw_instanced(Renderer& renderer, VS const& vs, FS const& fs, size_t start, size_t num, size_t instances);
+
+	template< typename State = DrawState<>, typename VS, typename FS >
+	static void draw_indexed_instanced(Renderer& renderer, VS const& vs, FS const& fs, size_t start, size_t num, int32_t* indices, size_t instances);
+
+private:
+
+	template< typename State, typename VS, typename FS >
+	static void process_primitives(Renderer& renderer, VS const& vs, FS const& fs, size_t start, size_t num, int32_t const* indices, size_t instances);
+
+	template< typename VS >
+	static void shade_vertices(void const* shader, size_t const* vindices, size_t count, VertexArray* attributes, VertexStreams const& output);
+
+	template< typename FS, typename State >
+	static void rasterise(Renderer* renderer, void const* shader, TriangleData const& triangle, TileRect const& tile, RasterStats& stats);
+
+	template< DepthTest Test >
+	static bool depth_test(float z, float currentDepth);
+};
+
+// Varyings are flattened into FLOATS packed floats, the layout they keep from
+// the vertex arena through clipping and triangle setup to the fragment
+// shader. The draw declares them as SLOTS varyings of up to four floats.
+template< typename V >
+struct varying_count
+{
+	static_assert(std::is_standard_layout< V >::value && sizeof(V) % sizeof(float) == 0, "varyings must be a struct of floats");
+	enum : int { FLOATS = sizeof(V) / sizeof(float), SLOTS = (FLOATS + 3) / 4 };
+	static_assert(int(SLOTS) <= int(Renderer::MAX_ATTRIBUTES), "too many varyings");
+};
+
+
+template< typename State, typename VS, typename FS >
+inline void Pipeline::draw(Renderer& renderer, VS const& vs, FS const& fs, size_t start, size_t num) {
+	process_primitives< State >(renderer, vs, fs, start, num, nullptr, 1);
+}
+
+template< typename State, typename VS, typename FS >
+inline void Pipeline::draw_indexed(Renderer& renderer, VS const& vs, FS const& fs, size_t start, size_t num, int32_t* indices) {
+	assert(indices != nullptr);
+	process_primitives< State >(renderer, vs, fs, start, num, indices, 1);
+}
+
+template< typename State, typename VS, typename FS >
+inline void Pipeline::draw_instanced(Renderer& renderer, VS const& vs, FS const& fs, size_t start, size_t num, size_t instances) {
+	process_primitives< State >(renderer, vs, fs, start, num, nullptr, instances);
+}
+
+template< typename State, typename VS, typename FS >
+inline void Pipeline::draw_indexed_instanced(Renderer& renderer, VS const& vs, FS const& fs, size_t start, size_t num, int32_t* indices, size_t instances) {
+	assert(indices != nullptr);
+	process_primitives< State >(renderer, vs, fs, start, num, indices, instances);
+}
+
+template< typename State, typename VS, typename FS >
+inline void Pipeline::process_primitives(Renderer& renderer, VS const& vs, FS const& fs, size_t start, size_t num, int32_t const* indices, size_t instances) {
+	typedef typename vertex_varyings< VS >::type Varyings;
+	static_assert(std::is_same< Varyings, typename fragment_varyings< FS >::type >::value, "vertex and fragment shaders must have the same varyings");
+	enum : int { FLOATS = varying_count< Varyings >::FLOATS };
+	assert(renderer.sample_count() == 1);
+
+	renderer._varyingSizes.clear();
+	for (int i = 0; i < FLOATS; i += 4) {
+		renderer._varyingSizes.push_back(std::min(4, FLOATS - i));
+	}
+
+	// The layout no longer belongs to the last per-vertex shader
+	renderer._inferredLayoutFunc = nullptr;
+
+	// Depth only draws skip the varying setup, and the depth state is the
+	// draw's so that triangle setup applies Hi-Z rejection as it allows
+	RenderMode mode = renderer._renderMode;
+	DepthTest depthTest = renderer._depthTest;
+	bool depthWrite = renderer._depthWrite;
+	renderer._renderMode = State::colorWrite ? RenderMode::Forward : RenderMode::DepthOnly;
+	renderer._depthTest = State::depthTest;
+	renderer._depthWrite = State::depthWrite;
+	renderer._vertexStage = &shade_vertices< VS >;
+	renderer._vertexStageShader = &vs;
+	renderer._pipelineRasterf = &rasterise< FS, State >;
+	renderer._pipelineShader = &fs;
+	renderer.process_primitives(start, num, indices, instances);
+	renderer._renderMode = mode;
+	renderer._depthTest = depthTest;
+	renderer._depthWrite = depthWrite;
+	renderer._vertexStage = nullptr;
+	renderer._vertexStageShader = nullptr;
+	renderer._pipelineRasterf = nullptr;
+	renderer._pipelineShader = nullptr;
+}
+
+template< typename VS >
+void Pipeline::shade_vertices(void const* shader, size_t const* vindices, size_t count, VertexArray* attributes, VertexStreams const& output) {
+	typedef typename vertex_varyings< VS >::type Varyings;
+	enum : int { FLOATS = varying_count< Varyings >::FLOATS };
+	VS const& vs = *static_cast< VS const* >(shader);
+	for (size_t j = 0; j < count; ++j) {
+		Varyings out;
+		glm::vec4 position = call_vertex_shader(vs, vindices[j], output.instance, attributes, out);
+		for (int c = 0; c < 4; ++c) {
+			output.position_stream(c)[j] = position[c];
+		}
+
+		float components[FLOATS];
+		std::memcpy(components, &out, sizeof(out));
+		for (int k = 0; k < FLOATS; ++k) {
+			output.varying_stream(k)[j] = components[k];
+		}
+	}
+}
+
+template< DepthTest Test >
+inline bool Pipeline::depth_test(float z, float currentDepth) {
+	return depth_test_passes(Test, z, currentDepth);
+}
+
+// The same traversal as default_rasteriser, and the same arithmetic per
+// fragment, with the pass flags and varying layout replaced by constants.
+template< typename FS, typename State >
+void Pipeline::rasterise(Renderer* renderer, void const* shader, TriangleData const& triangle, TileRect const& tile, RasterStats& stats) {
+	typedef typename fragment_varyings< FS >::type Varyings;
+	enum : int { FLOATS = varying_count< Varyings >::FLOATS };
+	FS const& fs = *static_cast< FS const* >(shader);
+	TriangleSetup setup;
+	if (!setup_triangle(renderer, triangle, tile, setup, stats)) {
+		return;
+	}
+
+	// BlockIterator only refreshes Hi-Z for draws that write depth
+	setup.writeDepth = State::depthWrite;
+
+	// As in shade_fragment, nothing is shaded when the blend state masks out
+	// every channel
+	bool const shade = State::colorWrite && setup.shade;
+
+	// The layout set for the draw packs Varyings as it is in memory
+	assert(setup.numComponents == FLOATS);
+	float const* cv = setup.interpolatedVaryings;
+	float const* dvdx = setup.xgradients;
+	float const* dvdy = setup.ygradients;
+
+	TriangleEdges const& edges = setup.edges;
+	for (BlockIterator block(setup, stats); block.next(); ) {
+		for (int y = block.y0; y <= block.y1; y += 1) {
+			float const* depth = depth_span(renderer, block.x0, y);
+			int64_t cx01 = edge_value(edges.c01, edges.dx01, edges.dy01, block.x0, y);
+			int64_t cx12 = edge_value(edges.c12, edges.dx12, edges.dy12, block.x0, y);
+			int64_t cx20 = edge_value(edges.c20, edges.dx20, edges.dy20, block.x0, y);
+			float fy = float(y - setup.bounds.miny);
+			float rowz = setup.cz + (setup.dzdy * fy);
+			float roww = setup.cw + (setup.dwdy * fy);
+			glm::vec4 colors[BLOCK_SIZE];
+			int colorMask = 0;
+			for (int x = block.x0; x <= block.x1; x += 1) {
+				if (block.inside || (cx01 > 0 && cx12 > 0 && cx20 > 0)) {
+					float fx = float(x - setup.bounds.minx);
+					float z = rowz + (setup.dzdx * fx);
+					JHSR_STATS(++stats.pixelsTested;)
+					if (depth_test< State::depthTest >(z, depth[x - block.x0])) {
+						if (State::depthWrite) {
+							renderer->depth_buffer().pixel< float >(x, y) = z;
+							block.written = true;
+						}
+
+						if (shade) {
+							JHSR_STATS(ScopedCycleTimer timer(stats.shadeCycles);)
+							float realw = 1.0f / (roww + (setup.dwdx * fx));
+							float components[FLOATS];
+							for (int k = 0; k < FLOATS; ++k) {
+								components[k] = (cv[k] + (dvdx[k] * fx) + (dvdy[k] * fy)) * realw;
+							}
+
+							Varyings in;
+							std::memcpy(&in, components, sizeof(in));
+							colors[x - block.x0] = fs(in);
+							colorMask |= 1 << (x - block.x0);
+							++stats.fragmentsShaded;
+						}
+					}
+					JHSR_STATS(else ++stats.depthFails;)
+				}
+
+				cx01 -= edges.dy01;
+				cx12 -= edges.dy12;
+				cx20 -= edges.dy20;
+			}
+
+			// Merging the row at once converts and blends four pixels at a time
+			if (shade && colorMask != 0) {
+				write_colors(renderer, setup, block.x0, y, colors, colorMask);
+			}
+		}
+	}
+}
+
+#endif // JHSR_PIPELINE_HPP
@@ -0,0 +1,79 @@
+#ifndef JHSR_PIPELINESTATS_HPP
+#define JHSR_PIPELINESTATS_HPP
+
+#include <cstdint>
+#include <chrono>
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+// Per pixel counters and the stage timers sit in the innermost loops, so they
+// are only compiled in when JHSR_PIPELINE_STATS is defined. Without it they
+// read as zero and cost nothing. Counters bumped per vertex, triangle or block
+// are always on.
+#ifdef JHSR_PIPELINE_STATS
+#define JHSR_STATS(code) code
+#else
+#define JHSR_STATS(code)
+#endif
+
+// What the stage timers count. The time stamp counter on x86, which ticks at
+// a constant rate close to the nominal clock, and nanoseconds elsewhere.
+inline uint64_t cycle_count() {
+#if defined(__i386__) || defined(__x86_64__)
+	return __rdtsc();
+#else
+	return uint64_t(std::chrono::duration_cast< std::chrono::nanoseconds >(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+// Adds the cycles between its construction and destruction to counter
+class ScopedCycleTimer
+{
+public:
+
+	explicit ScopedCycleTimer(uint64_t& counter) : _counter(counter), _start(cycle_count()) {}
+
+	~ScopedCycleTimer() { _counter += cycle_count() - _start; }
+
+private:
+
+	uint64_t& _counter;
+	uint64_t _start;
+};
+
+// Everything the pipeline has done since the stats were last reset, in the
+// spirit of a pipeline statistics query. Back end cycles are summed over
+// every thread that ran the stage, so with several rasterising threads they
+// can add up to more than the wall time. Vertex cycles are the stage's wall
+// time on the submitting thread, however many threads shaded vertices.
+struct PipelineStats
+{
+	// Front end. Only vertex cache misses are shaded. Rejected triangles were
+	// wholly outside the view and clipped ones crossed a clip plane. Culled
+	// counts what clipping left, so one clipped triangle can be culled as
+	// several.
+	uint64_t verticesShaded;
+	uint64_t trianglesSubmitted;
+	uint64_t trianglesRejected;
+	uint64_t trianglesClipped;
+	uint64_t trianglesCulled;
+
+	// Back end. Tested pixels are the covered ones that reached the depth
+	// test, so pixelsTested == depthPasses + depthFails. These three need
+	// JHSR_PIPELINE_STATS.
+	uint64_t pixelsTested;
+	uint64_t depthPasses;
+	uint64_t depthFails;
+	uint64_t fragmentShaderInvocations;
+
+	// Stage timers, which need JHSR_PIPELINE_STATS. Vertex covers shading,
+	// clipping and culling, setup covers binning and triangle setup, and
+	// rasterisation covers traversal and depth testing but not shading.
+	uint64_t vertexCycles;
+	uint64_t setupCycles;
+	uint64_t rasterCycles;
+	uint64_t shadeCycles;
+};
+
+#endif // JHSR_PIPELINESTATS_HPP
@@ -0,0 +1,66 @@
+#include "RenderQueue.hpp"
+#include <utility>
+
+// The worker is started last, once everything it reads is initialised
+RenderQueue::RenderQueue(Renderer& renderer)
+: _renderer(renderer),
+  _busy(false),
+  _shutdown(false),
+  _worker(&RenderQueue::worker_loop, this) {
+
+}
+
+RenderQueue::~RenderQueue() {
+	{
+		std::lock_guard< std::mutex > lock(_mutex);
+		_shutdown = true;
+	}
+
+	_wakeCondition.notify_one();
+	_worker.join();
+}
+
+Fence RenderQueue::submit(CommandBuffer buffer) {
+	Fence fence;
+	{
+		std::lock_guard< std::mutex > lock(_mutex);
+		_pending.push_back(Submission());
+		_pending.back().buffer = std::move(buffer);
+		fence = _pending.back().done.get_future().share();
+	}
+
+	_wakeCondition.notify_one();
+	return fence;
+}
+
+void RenderQueue::wait_idle() {
+	std::unique_lock< std::mutex > lock(_mutex);
+	_idleCondition.wait(lock, [this] { return _pending.empty() && !_busy; });
+}
+
+// Buffers already submitted when the queue is destroyed still execute, so
+// no fence is left unsignalled.
+void RenderQueue::worker_loop() {
+	for (;;) {
+		Submission submission;
+		{
+			std::unique_lock< std::mutex > lock(_mutex);
+			_wakeCondition.wait(lock, [this] { return _shutdown || !_pending.empty(); });
+			if (_pending.empty()) {
+				return;
+			}
+
+			submission = std::move(_pending.front());
+			_pending.pop_front();
+			_busy = true;
+		}
+
+		submission.done.set_value(_renderer.execute(submission.buffer));
+		{
+			std::lock_guard< std::mutex > lock(_mutex);
+			_busy = false;
+		}
+
+		_idleCondition.notify_all();
+	}
+}
@@ -0,0 +1,69 @@
+#ifndef JHSR_RENDERQUEUE_HPP
+#define JHSR_RENDERQUEUE_HPP
+
+#include "Renderer.hpp"
+#include "CommandBuffer.hpp"
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+
+// Signalled once a submitted buffer has executed. get() waits for it and
+// returns the image the buffer presented, or nullptr if it didn't present.
+typedef std::shared_future< Framebuffer const* > Fence;
+
+// Executes command buffers on a thread of its own, in submission order, so
+// the application can record frame N + 1 while frame N renders. While the
+// queue has work the renderer belongs to it: only touch the renderer, or
+// anything a pending buffer reads, once the fence of the last buffer that
+// uses it has signalled. With the renderer double buffered, a presented
+// image can be read until the buffer after the next one starts, so
+//
+//   Fence previous;
+//   for (;;) {
+//       CommandBuffer frame = record_frame();
+//       Fence fence = queue.submit(std::move(frame));
+//       if (previous.valid()) display(*previous.get());
+//       previous = fence;
+//   }
+//
+// displays each frame while the next one renders.
+class RenderQueue
+{
+public:
+
+	explicit RenderQueue(Renderer& renderer);
+
+	// Finishes everything already submitted
+	~RenderQueue();
+
+	Fence submit(CommandBuffer buffer);
+
+	// Waits until every submitted buffer has executed
+	void wait_idle();
+
+private:
+
+	RenderQueue(RenderQueue const&) = delete;
+	RenderQueue& operator=(RenderQueue const&) = delete;
+
+	struct Submission
+	{
+		CommandBuffer buffer;
+		std::promise< Framebuffer const* > done;
+	};
+
+	void worker_loop();
+
+	Renderer& _renderer;
+	std::mutex _mutex;
+	std::condition_variable _wakeCondition;
+	std::condition_variable _idleCondition;
+	std::deque< Submission > _pending;
+	bool _busy;
+	bool _shutdown;
+	std::thread _worker;
+};
+
+#endif // JHSR_RENDERQUEUE_HPP
@@ -1,12 +1,12 @@
 #include "Renderer.hpp"
+#include "TriangleSetup.hpp"
+#include "CommandBuffer.hpp"
 #include <tuple>
+#include <algorithm>
 #include <cstdio>
 #include <cassert>
 
-inline void process_vert(Renderer& renderer, glm::vec4& processedVert, VaryingData& vshOutput) {
-	assert(vshOutput[0].size == 4);
-	glm::vec4& vert = vshOutput[0].v4;
-
+inline void process_vert(Renderer& renderer, glm::vec4& processedVert, glm::vec4 const& vert) {
 	// calculate normalized device coordinates
 	float invW = 1.0f / vert[3];
 	processedVert[0] = vert[0] * invW;
@@ -23,13 +23,89 @@ inline void process_vert(Renderer& renderer, glm::vec4& processedVert, VaryingDa
 };
 
 void Renderer::draw(size_t start, size_t num) {
-	assert(_currentVsh != nullptr);
-	assert(_currentFsh != nullptr);
+	process_primitives(start, num, nullptr, 1);
+}
+
+void Renderer::draw_indexed(size_t start, size_t num, int32_t *indices) {
+	assert(indices != nullptr);
+	process_primitives(start, num, indices, 1);
+}
+
+void Renderer::draw_instanced(size_t start, size_t num, size_t instances) {
+	process_primitives(start, num, nullptr, instances);
+}
+
+void Renderer::draw_indexed_instanced(size_t start, size_t num, int32_t* indices, size_t instances) {
+	assert(indices != nullptr);
+	process_primitives(start, num, indices, instances);
+}
+
+// The buffer's shaders only live as long as it does, so the shaders bound
+// before it are bound again afterwards.
+Framebuffer const* Renderer::execute(CommandBuffer const& buffer) {
+	Shader* vsh = _currentVsh;
+	Shader* fsh = _currentFsh;
+	uint64_t presentCount = _presentCount;
+	for (CommandBuffer::Command const& command : buffer._commands) {
+		command(*this);
+	}
+
+	_currentVsh = vsh;
+	_currentFsh = fsh;
+	return (_presentCount != presentCount) ? _presented : nullptr;
+}
+
+void Renderer::clear(glm::vec4 const& color, float depth) {
+	uint32_t pixel = pack_rgba8(color);
+	void const* value = (_framebuffer->format() == PixelFormat::RGBA32F) ? static_cast< void const* >(&color) : &pixel;
+	if (_multisampleBuffer != nullptr) {
+		_multisampleBuffer->clear(value);
+	}
+	else {
+		_framebuffer->clear(value);
+	}
+
+	float depths[MultisampleBuffer::SAMPLES];
+	std::fill(depths, depths + _sampleCount, depth);
+	_depthBuffer->clear(depths);
+	_hiZBuffer.clear(*_depthBuffer, depth);
+}
+
+// Bands of TILE_SIZE rows are resolved in parallel
+void Renderer::resolve() {
+	if (_multisampleBuffer == nullptr) {
+		return;
+	}
+
+	size_t height = _framebuffer->height();
+	_threadPool->parallel_for((height + TILE_SIZE - 1) / TILE_SIZE, [this] (size_t index, size_t threadIndex) {
+		size_t y0 = index * TILE_SIZE;
+		_multisampleBuffer->resolve(*_framebuffer, y0, std::min(y0 + TILE_SIZE, _framebuffer->height()));
+	});
+}
+
+void Renderer::present() {
+	resolve();
+	_presented = _framebuffer;
+	_backBuffer = (_backBuffer + 1) % _colorBuffers.size();
+	_framebuffer = _colorBuffers[_backBuffer];
+	++_presentCount;
+}
+
+// Every instance looks up the same vertices in the same order, and as a
+// FIFO evicts whatever the last instance left after the same number of
+// misses as an empty one, every instance gets the slots of the first moved
+// along by the number of vertices it shaded. So only the first instance goes
+// through the cache, and the cache's hit and miss counts are for one
+// instance.
+void Renderer::process_primitives(size_t start, size_t num, int32_t const* indices, size_t instances) {
+	assert(_currentVsh != nullptr || _vertexStage != nullptr);
+	assert(_currentFsh != nullptr || _pipelineRasterf != nullptr);
 
 	size_t increment;
 	size_t startOffset;
-	size_t indices1[] = {-2, -1, 0};
-	size_t indices2[] = {-2, -1, 0};
+	ptrdiff_t indices1[] = {-2, -1, 0};
+	ptrdiff_t indices2[] = {-2, -1, 0};
 	if (_primitiveTopology == PrimitiveTopology::TriangleList) {
 		increment = 3;
 		startOffset = 2;
@@ -48,75 +124,471 @@ void Renderer::draw(size_t start, size_t num) {
 		std::swap(indices2[1], indices2[2]);
 	}
 
+	if (num < 3 || instances == 0) {
+		return;
+	}
+
+	JHSR_STATS(uint64_t vertexStart = cycle_count();)
+	if (indices != nullptr) {
+		auto range = std::minmax_element(indices + start, indices + start + num);
+		_vertexCache.begin_batch(*range.first, *range.second);
+	}
+	else {
+		_vertexCache.begin_batch(start, start + num - 1);
+	}
+
+	_triangleSlots.clear();
 	for (size_t i = start + startOffset; i < (start + num); i += increment) {
-		TriangleData triangle = std::make_tuple(
-			glm::vec4(), glm::vec4(), glm::vec4(),
-			_currentVsh->vfunc(i + indices1[0], _attributes, _currentVsh->uniforms),
-			_currentVsh->vfunc(i + indices1[1], _attributes, _currentVsh->uniforms),
-			_currentVsh->vfunc(i + indices1[2], _attributes, _currentVsh->uniforms)
-		);
-
-		process_vert(*this, get_triangle_vert0(triangle), get_triangle_varying0(triangle));
-		process_vert(*this, get_triangle_vert1(triangle), get_triangle_varying1(triangle));
-		process_vert(*this, get_triangle_vert2(triangle), get_triangle_varying2(triangle));
-		default_rasteriser(this, *_currentFsh, triangle);
+		size_t v0 = i + indices1[0], v1 = i + indices1[1], v2 = i + indices1[2];
+		if (indices != nullptr) {
+			v0 = indices[v0], v1 = indices[v1], v2 = indices[v2];
+		}
 
+		_triangleSlots.push_back(_vertexCache.lookup(v0));
+		_triangleSlots.push_back(_vertexCache.lookup(v1));
+		_triangleSlots.push_back(_vertexCache.lookup(v2));
 		std::swap(indices1, indices2);
 	}
+
+	_instancedAttributes = false;
+	for (VertexArray const& attribute : _attributes) {
+		_instancedAttributes = _instancedAttributes || (attribute.stepRate != 0);
+	}
+
+	_instanceVertices = _vertexCache.shade_list().size();
+	size_t instanceSlots = _triangleSlots.size();
+	size_t passInstances = std::min(instances, std::max< size_t >(1, INSTANCE_PASS_VERTICES / std::max< size_t >(1, _instanceVertices)));
+	_triangleSlots.resize(instanceSlots * passInstances);
+	for (size_t k = 1; k < passInstances; ++k) {
+		uint32_t offset = uint32_t(k * _instanceVertices);
+		uint32_t* slots = &_triangleSlots[k * instanceSlots];
+		for (size_t i = 0; i < instanceSlots; ++i) {
+			slots[i] = _triangleSlots[i] + offset;
+		}
+	}
+
+	// The vertex stage computes clip codes against the guard band, so it has
+	// to follow this draw's viewport rather than the last one's
+	_clipper.set_viewport(float(_viewport.w), float(_viewport.h));
+	_pipelineStats.trianglesSubmitted += (instanceSlots / 3) * instances;
+	_culledTriangles = 0;
+	for (_passInstance = 0; _passInstance < instances; _passInstance += passInstances) {
+		size_t count = std::min(passInstances, instances - _passInstance);
+		_passVertices = _instanceVertices * count;
+		_triangleSlots.resize(instanceSlots * count);
+		shade_vertices();
+		clip_triangles();
+		JHSR_STATS(_pipelineStats.vertexCycles += cycle_count() - vertexStart;)
+		_hiZBuffer.sync(*_depthBuffer);
+
+		if (_renderMode == RenderMode::DepthPrePass) {
+			_rasterPass = RenderMode::DepthOnly;
+			rasterise_triangles();
+			_rasterPass = RenderMode::ShadeEqual;
+			rasterise_triangles();
+		}
+		else {
+			_rasterPass = _renderMode;
+			rasterise_triangles();
+		}
+
+		JHSR_STATS(vertexStart = cycle_count();)
+	}
 }
 
-void Renderer::draw_indexed(size_t start, size_t num, int32_t *indices) {
-		assert(_currentVsh != nullptr);
-	assert(_currentFsh != nullptr);
+// Per-vertex shaders don't declare their varyings, so the layout is taken
+// from the output of the first vertex the first time the shader is used,
+// and again whenever another shader's layout has replaced it since.
+// Specialised draws set the layout themselves before drawing. Everything
+// downstream of the vertex stage holds varyings packed in this layout, with
+// no per-varying size stored alongside them.
+void Renderer::update_varying_layout() {
+	if (_vertexStage == nullptr) {
+		if (_currentVsh->bfunc != nullptr || !_currentVsh->varyingSizes.empty()) {
+			_varyingSizes = _currentVsh->varyingSizes;
+			_inferredLayoutFunc = nullptr;
+		}
+		else if (_currentVsh->vfunc != _inferredLayoutFunc) {
+			VaryingData probe = _currentVsh->vfunc(_vertexCache.shade_list()[0], _attributes, _currentVsh->uniforms);
+			_varyingSizes.clear();
+			for (size_t i = 1; i < probe.size(); ++i) {
+				_varyingSizes.push_back(probe[i].size);
+			}
 
-	size_t increment;
-	size_t startOffset;
-	size_t indices1[] = {-2, -1, 0};
-	size_t indices2[] = {-2, -1, 0};
-	if (_primitiveTopology == PrimitiveTopology::TriangleList) {
-		increment = 3;
-		startOffset = 2;
+			_inferredLayoutFunc = _currentVsh->vfunc;
+		}
 	}
-	else if (_primitiveTopology == PrimitiveTopology::TriangleStrip) {
-		increment = 1;
-		startOffset = 2;
-		indices2[0] = -1, indices2[1] = -2, indices2[2] = 0;
+
+	assert(_varyingSizes.size() <= MAX_ATTRIBUTES);
+	_varyingComponents = 0;
+	for (int size : _varyingSizes) {
+		assert(size > 0 && size <= MAX_VARYING_COMPONENTS / MAX_ATTRIBUTES);
+		_varyingComponents += size;
+	}
+}
+
+// Shades every vertex that missed the cache into the post-transform buffer,
+// once for each instance in the pass. Slot (k * n) + i of the buffer is
+// shade_list()[i] of the pass's k'th instance, where n is the size of the
+// shade list. Slots are independent, so large draws are split into
+// VERTEX_CHUNK_SIZE chunks shaded in parallel, and primitive assembly has
+// already picked the slots each triangle reads.
+void Renderer::shade_vertices() {
+	size_t count = _passVertices;
+	if (count == 0) {
+		return;
+	}
+
+	_pipelineStats.verticesShaded += count;
+	update_varying_layout();
+	_vertexStreams.resize((4 + _varyingComponents) * count);
+	_clipPositions.resize(count);
+	_clipCodes.resize(count);
+	_windowPositions.resize(count);
+	_snappedPositions.resize(count);
+	_varyingArena.resize(_varyingComponents * count);
+	size_t numChunks = (count + VERTEX_CHUNK_SIZE - 1) / VERTEX_CHUNK_SIZE;
+	if (numChunks == 1 || _threadPool->num_threads() == 1) {
+		shade_vertex_range(0, count);
+		return;
+	}
+
+	_threadPool->parallel_for(numChunks, [this] (size_t index, size_t threadIndex) {
+		size_t begin = index * VERTEX_CHUNK_SIZE;
+		shade_vertex_range(begin, std::min(begin + VERTEX_CHUNK_SIZE, _passVertices));
+	});
+}
+
+// Shades slots [begin, end) VERTEX_BATCH_SIZE at a time, ending batches early
+// where one instance's slots end and the next one's start. Each batch is then
+// transposed into the varying arena, which holds each slot's varyings packed
+// into _varyingComponents consecutive floats for the rasteriser to read in
+// place.
+void Renderer::shade_vertex_range(size_t begin, size_t end) {
+	std::vector< size_t > const& shadeList = _vertexCache.shade_list();
+	size_t count = _passVertices;
+	VertexArray instanceAttributes[MAX_ATTRIBUTES];
+	VertexArray* attributes = _instancedAttributes ? instanceAttributes : _attributes;
+	size_t attributesInstance = SIZE_MAX;
+	size_t batchSize;
+	for (size_t base = begin; base < end; base += batchSize) {
+		size_t instance = base / _instanceVertices, first = base - (instance * _instanceVertices);
+		batchSize = std::min(std::min(size_t(VERTEX_BATCH_SIZE), end - base), _instanceVertices - first);
+		if (_instancedAttributes && instance != attributesInstance) {
+			instance_attributes(_passInstance + instance, instanceAttributes);
+			attributesInstance = instance;
+		}
+
+		VertexStreams streams;
+		streams.position = _vertexStreams.data() + base;
+		streams.varyings = _vertexStreams.data() + (4 * count) + base;
+		streams.stride = count;
+		streams.components = _varyingComponents;
+		streams.instance = _passInstance + instance;
+		if (_vertexStage != nullptr) {
+			_vertexStage(_vertexStageShader, &shadeList[first], batchSize, attributes, streams);
+		}
+		else {
+			run_vertex_shader(*_currentVsh, &shadeList[first], batchSize, attributes, streams);
+		}
+
+		for (size_t j = 0; j < batchSize; ++j) {
+			glm::vec4& clip = _clipPositions[base + j];
+			clip = glm::vec4(streams.position_stream(0)[j], streams.position_stream(1)[j], streams.position_stream(2)[j], streams.position_stream(3)[j]);
+			_clipCodes[base + j] = _clipper.clip_code(clip);
+			process_vert(*this, _windowPositions[base + j], clip);
+
+			float* packed = _varyingArena.data() + ((base + j) * _varyingComponents);
+			float const* stream = streams.varyings + j;
+			for (size_t k = 0; k < _varyingComponents; ++k, stream += count) {
+				packed[k] = *stream;
+			}
+		}
+
+		snap_vertices(&_windowPositions[base], batchSize, _subpixelBits, &_snappedPositions[base]);
+	}
+}
+
+// The bound attributes with every per-instance one pointed at instance's
+// element
+void Renderer::instance_attributes(size_t instance, VertexArray* attributes) {
+	for (int i = 0; i < MAX_ATTRIBUTES; ++i) {
+		attributes[i] = _attributes[i];
+		if (_attributes[i].stepRate != 0) {
+			attributes[i].vertices = _attributes[i].element(instance / _attributes[i].stepRate);
+		}
+	}
+}
+
+// Sorts the draw's triangles into the ones that can be rasterised as they
+// are, the ones that can be dropped, and the ones that cross the near or far
+// plane or leave the guard band. Clipped polygons are fanned into triangles
+// whose new vertices are appended to the post-transform buffer as extra
+// slots, so every visible triangle is assembled the same way. Culling runs on
+// what is left, so nothing past this point sees a culled triangle.
+void Renderer::clip_triangles() {
+	_visibleSlots.clear();
+	size_t culled = _culledTriangles;
+	if (_triangleSlots.empty()) {
+		return;
+	}
+
+	int numComponents = int(_varyingComponents);
+	for (size_t t = 0; t < _triangleSlots.size(); t += 3) {
+		uint32_t const* slots = &_triangleSlots[t];
+		uint32_t c0 = _clipCodes[slots[0]], c1 = _clipCodes[slots[1]], c2 = _clipCodes[slots[2]];
+		if ((c0 & c1 & c2 & CLIP_REJECT_MASK) != 0) {
+			++_clipStats.trianglesRejected;
+			continue;
+		}
+
+		uint32_t mask = (c0 | c1 | c2) & CLIP_PLANES_MASK;
+		if (mask == 0) {
+			++_clipStats.trianglesAccepted;
+			add_visible_triangle(slots[0], slots[1], slots[2]);
+			continue;
+		}
+
+		++_clipStats.trianglesClipped;
+		glm::vec4 const* positions[3];
+		float const* varyings[3];
+		for (int k = 0; k < 3; ++k) {
+			positions[k] = &_clipPositions[slots[k]];
+			varyings[k] = _varyingArena.data() + (slots[k] * numComponents);
+		}
+
+		int count = _clipper.clip_triangle(positions, varyings, numComponents, mask);
+		if (count == 0) {
+			continue;
+		}
+
+		uint32_t polygon[Clipper::MAX_VERTICES];
+		for (int i = 0; i < count; ++i) {
+			int corner = _clipper.corner(i);
+			polygon[i] = (corner >= 0) ? slots[corner] : add_clipped_vertex(i);
+		}
+
+		for (int i = 1; i + 1 < count; ++i) {
+			add_visible_triangle(polygon[0], polygon[i], polygon[i + 1]);
+		}
+	}
+
+	_clipStats.trianglesCulled += _culledTriangles - culled;
+}
+
+// The rasteriser only covers triangles with positive snapped area, which
+// after the winding reorder in process_primitives are the front facing ones.
+// Back facing triangles that survive culling are flipped so they get covered
+// too.
+void Renderer::add_visible_triangle(uint32_t s0, uint32_t s1, uint32_t s2) {
+	int64_t area = snapped_area(_snappedPositions[s0], _snappedPositions[s1], _snappedPositions[s2]);
+	bool front = (area > 0);
+	if (area == 0 || (front && _cullMode == CullMode::Front) || (!front && _cullMode == CullMode::Back)) {
+		++_culledTriangles;
+		return;
+	}
+
+	if (!front) {
+		std::swap(s1, s2);
+	}
+
+	_visibleSlots.push_back(s0);
+	_visibleSlots.push_back(s1);
+	_visibleSlots.push_back(s2);
+}
+
+// Adds polygon vertex index of the clipper's output as a new post-transform
+// slot. Slots are only turned into pointers after clipping has finished, so
+// growing the buffers here is safe.
+uint32_t Renderer::add_clipped_vertex(int index) {
+	uint32_t slot = uint32_t(_windowPositions.size());
+	glm::vec4 window;
+	process_vert(*this, window, _clipper.position(index));
+	_windowPositions.push_back(window);
+	_snappedPositions.push_back(glm::ivec2());
+	snap_vertices(&window, 1, _subpixelBits, &_snappedPositions.back());
+	float const* varyings = _clipper.varyings(index);
+	_varyingArena.insert(_varyingArena.end(), varyings, varyings + _varyingComponents);
+	return slot;
+}
+
+void Renderer::assemble_triangle(uint32_t const* slots, TriangleData& triangle) const {
+	for (int k = 0; k < 3; ++k) {
+		triangle.verts[k] = _windowPositions[slots[k]];
+		triangle.snapped[k] = _snappedPositions[slots[k]];
+		triangle.varyings[k] = _varyingArena.data() + (slots[k] * _varyingComponents);
+	}
+
+	triangle.varyingSizes = _varyingSizes.data();
+	triangle.numVaryings = int(_varyingSizes.size());
+	triangle.numComponents = int(_varyingComponents);
+}
+
+void Renderer::rasterise_triangles() {
+	TileRect screen = { 0, 0, int(_framebuffer->width()) - 1, int(_framebuffer->height()) - 1 };
+	bool serial = (_threadPool->num_threads() == 1);
+	for (size_t t = 0; t < _visibleSlots.size(); t += 3) {
+		TriangleData triangle;
+		assemble_triangle(&_visibleSlots[t], triangle);
+		if (serial) {
+			JHSR_STATS(ScopedCycleTimer timer(_threadStats[0].rasteriserCycles);)
+			rasterise_triangle(triangle, screen, _threadStats[0]);
+		}
+		else {
+			bin_triangle(triangle);
+		}
+	}
+
+	flush_triangles();
+}
+
+// The tile level of the block hierarchy: tiles the bounding box overlaps but
+// the triangle misses entirely are never binned.
+void Renderer::bin_triangle(TriangleData const& triangle) {
+	JHSR_STATS(ScopedCycleTimer timer(_pipelineStats.setupCycles);)
+	TileRect bounds = triangle_bounds(triangle, _framebuffer->width(), _framebuffer->height());
+	if (bounds.minx > bounds.maxx || bounds.miny > bounds.maxy) {
+		return;
+	}
+
+	// Multisampled, tiles are tested against the outer edges of the samples
+	TriangleEdges edges;
+	if (_sampleCount > 1) {
+		TriangleEdges samples[MultisampleBuffer::SAMPLES], inner;
+		setup_sample_edges(triangle, _subpixelBits, samples, edges, inner);
 	}
 	else {
-		assert(false);
+		setup_edges(triangle, _subpixelBits, edges);
 	}
 
-	if (_winding == PolygonWinding::Clockwise) {
-		std::swap(indices1[1], indices1[2]);
-		std::swap(indices2[1], indices2[2]);
+	uint32_t triangleIndex = uint32_t(_triangles.size());
+	bool binned = false;
+	for (int ty = bounds.miny / TILE_SIZE; ty <= bounds.maxy / TILE_SIZE; ++ty) {
+		for (int tx = bounds.minx / TILE_SIZE; tx <= bounds.maxx / TILE_SIZE; ++tx) {
+			int x0 = std::max(tx * TILE_SIZE, bounds.minx), x1 = std::min(((tx + 1) * TILE_SIZE) - 1, bounds.maxx);
+			int y0 = std::max(ty * TILE_SIZE, bounds.miny), y1 = std::min(((ty + 1) * TILE_SIZE) - 1, bounds.maxy);
+			if (classify_block(edges, x0, y0, x1, y1) == BlockCoverage::Outside) {
+				++_threadStats[0].tilesRejected;
+				continue;
+			}
+
+			std::vector< uint32_t >& bin = _tileBins[(ty * _tilesX) + tx];
+			if (bin.empty()) {
+				_activeTiles.push_back((ty * _tilesX) + tx);
+			}
+
+			bin.push_back(triangleIndex);
+			binned = true;
+		}
 	}
 
-	for (size_t i = start + startOffset; i < (start + num); i += increment) {
-		TriangleData triangle = std::make_tuple(
-			glm::vec4(), glm::vec4(), glm::vec4(),
-			_currentVsh->vfunc(indices[i + indices1[0]], _attributes, _currentVsh->uniforms),
-			_currentVsh->vfunc(indices[i + indices1[1]], _attributes, _currentVsh->uniforms),
-			_currentVsh->vfunc(indices[i + indices1[2]], _attributes, _currentVsh->uniforms)
-		);
-
-		process_vert(*this, get_triangle_vert0(triangle), get_triangle_varying0(triangle));
-		process_vert(*this, get_triangle_vert1(triangle), get_triangle_varying1(triangle));
-		process_vert(*this, get_triangle_vert2(triangle), get_triangle_varying2(triangle));
-		default_rasteriser(this, *_currentFsh, triangle);
+	if (binned) {
+		_triangles.push_back(triangle);
+	}
+}
 
-		std::swap(indices1, indices2);
+// Each tile is owned by exactly one task and its triangles are rasterised in
+// submission order, so no two threads ever write the same pixel and the result
+// matches rasterising the whole batch serially.
+void Renderer::flush_triangles() {
+	if (_activeTiles.empty()) {
+		_triangles.clear();
+		return;
+	}
+
+	// Only this is captured so the std::function stays within its small
+	// buffer and dispatching a flush doesn't allocate.
+	_threadPool->parallel_for(_activeTiles.size(), [this] (size_t index, size_t threadIndex) {
+		int width = int(_framebuffer->width()), height = int(_framebuffer->height());
+		uint32_t tileIndex = _activeTiles[index];
+		TileRect tile;
+		tile.minx = int(tileIndex % _tilesX) * TILE_SIZE;
+		tile.miny = int(tileIndex / _tilesX) * TILE_SIZE;
+		tile.maxx = std::min(tile.minx + TILE_SIZE, width) - 1;
+		tile.maxy = std::min(tile.miny + TILE_SIZE, height) - 1;
+		JHSR_STATS(ScopedCycleTimer timer(_threadStats[threadIndex].rasteriserCycles);)
+		for (uint32_t triangleIndex : _tileBins[tileIndex]) {
+			rasterise_triangle(_triangles[triangleIndex], tile, _threadStats[threadIndex]);
+		}
+	});
+
+	for (uint32_t tileIndex : _activeTiles) {
+		_tileBins[tileIndex].clear();
+	}
+
+	_activeTiles.clear();
+	_triangles.clear();
+}
+
+void Renderer::set_framebuffer(size_t w, size_t h, size_t bytesPerPixel, FramebufferLayout layout) {
+	assert(bytesPerPixel == 4 || bytesPerPixel == 16);
+	set_framebuffer(w, h, (bytesPerPixel == 16) ? PixelFormat::RGBA32F : PixelFormat::RGBA8, layout);
+}
+
+void Renderer::set_framebuffer(size_t w, size_t h, PixelFormat colorFormat, FramebufferLayout layout) {
+	assert(colorFormat == PixelFormat::RGBA8 || colorFormat == PixelFormat::RGBA32F);
+	assert(w <= MAX_FRAMEBUFFER_SIZE && h <= MAX_FRAMEBUFFER_SIZE);
+	for (Framebuffer*& buffer : _colorBuffers) {
+		delete buffer;
+		buffer = new Framebuffer(w, h, colorFormat, layout);
 	}
+
+	_backBuffer = 0;
+	_framebuffer = _colorBuffers[0];
+	_presented = nullptr;
+	allocate_sample_buffers();
+
+	_tilesX = (w + TILE_SIZE - 1) / TILE_SIZE;
+	_tilesY = (h + TILE_SIZE - 1) / TILE_SIZE;
+	_tileBins.assign(_tilesX * _tilesY, std::vector< uint32_t >());
+	_activeTiles.clear();
 }
 
-void Renderer::set_framebuffer(size_t w, size_t h, size_t bytesPerPixel) {
+void Renderer::set_framebuffer_count(size_t count) {
+	assert(count > 0);
+	size_t previous = _colorBuffers.size();
+	for (size_t i = count; i < previous; ++i) {
+		delete _colorBuffers[i];
+	}
+
+	_colorBuffers.resize(count, nullptr);
 	if (_framebuffer != nullptr) {
-		delete _framebuffer;
+		Framebuffer const& buffer = *_colorBuffers[0];
+		for (size_t i = previous; i < count; ++i) {
+			_colorBuffers[i] = new Framebuffer(buffer.width(), buffer.height(), buffer.format(), buffer.layout());
+		}
+
+		_backBuffer = 0;
+		_framebuffer = _colorBuffers[0];
+		_presented = nullptr;
+	}
+}
+
+void Renderer::set_sample_count(int samples) {
+	assert(samples == 1 || samples == MultisampleBuffer::SAMPLES);
+	if (samples != _sampleCount) {
+		_sampleCount = samples;
+		if (_framebuffer != nullptr) {
+			allocate_sample_buffers();
+		}
 	}
+}
 
-	if (_depthBuffer != nullptr) {
-		delete _depthBuffer;
+// Depth and, when multisampled, colour samples for the back buffer's size,
+// format and layout
+void Renderer::allocate_sample_buffers() {
+	size_t w = _framebuffer->width(), h = _framebuffer->height();
+	FramebufferLayout layout = _framebuffer->layout();
+	delete _depthBuffer;
+	delete _multisampleBuffer;
+	_multisampleBuffer = nullptr;
+	if (_sampleCount > 1) {
+		_depthBuffer = new Framebuffer(w, h, _sampleCount * sizeof(float), layout);
+		_multisampleBuffer = new MultisampleBuffer(w, h, _framebuffer->format(), layout);
+	}
+	else {
+		_depthBuffer = new Framebuffer(w, h, PixelFormat::R32F, layout);
 	}
 
-	_framebuffer = new Framebuffer(w, h, bytesPerPixel);
-	_depthBuffer = new Framebuffer(w, h, 4);
-}
\ No newline at end of file
+	_hiZBuffer.resize(w, h, BLOCK_SIZE, TILE_SIZE);
+}
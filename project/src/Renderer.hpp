@@ -5,7 +5,18 @@
 #include "Shader.hpp"
 #include "VertexArray.hpp"
 #include "DefaultRasteriser.hpp"
+#include "SimdRasteriser.hpp"
+#include "ThreadPool.hpp"
+#include "VertexCache.hpp"
+#include "HiZBuffer.hpp"
+#include "MultisampleBuffer.hpp"
+#include "OutputMerger.hpp"
+#include "Clipper.hpp"
+#include "PipelineStats.hpp"
 #include <vector>
+#include <cstdint>
+
+class CommandBuffer;
 
 enum class PrimitiveTopology
 {
@@ -19,6 +30,31 @@ enum class PolygonWinding
 	CounterClockwise
 };
 
+// Which facing to discard. Front facing triangles are the ones whose window
+// space winding matches the polygon winding. Zero area triangles are always
+// discarded.
+enum class CullMode
+{
+	None,
+	Front,
+	Back
+};
+
+// Forward shades every fragment that passes the depth test. DepthOnly and
+// ShadeEqual are the two halves of a depth pre-pass: the first only writes
+// depth, the second shades fragments whose z equals the stored depth without
+// writing it, whatever the depth test and write state. Issuing a frame's
+// draws once in each mode shades every visible pixel exactly once.
+// DepthPrePass runs both halves over each draw's triangles in turn, which
+// removes the overdraw within a draw.
+enum class RenderMode
+{
+	Forward,
+	DepthOnly,
+	ShadeEqual,
+	DepthPrePass
+};
+
 struct Viewport
 {
 	size_t x, y, w, h;
@@ -28,10 +64,24 @@ struct Viewport
 class Renderer
 {
 	friend class Pipeline;
-	enum : int { MAX_ATTRIBUTES = 10 };
 
 public:
 
+	// A fragment shader gets up to MAX_ATTRIBUTES varyings, and as many
+	// derivatives of each again when it asks for them. None is larger than a
+	// mat4, so a vertex's varyings pack into MAX_VARYING_COMPONENTS floats.
+	// A vertex chunk is the unit of work of the parallel vertex stage: enough
+	// batches to outweigh the cost of handing it to a thread, few enough that
+	// a chunk's outputs stay in a core's L2 while they are transposed.
+	enum : int { MAX_ATTRIBUTES = 10, MAX_FRAGMENT_INPUTS = 3 * MAX_ATTRIBUTES, MAX_VARYING_COMPONENTS = 16 * MAX_ATTRIBUTES, TILE_SIZE = 64, BLOCK_SIZE = 8, VERTEX_BATCH_SIZE = 64, VERTEX_CHUNK_SIZE = 16 * VERTEX_BATCH_SIZE };
+
+	// Rasterisation is watertight for targets up to MAX_FRAMEBUFFER_SIZE
+	// square at every supported subpixel precision.
+	enum : int { MIN_SUBPIXEL_BITS = 4, MAX_SUBPIXEL_BITS = 8, DEFAULT_SUBPIXEL_BITS = 4, MAX_FRAMEBUFFER_SIZE = 16384 };
+
+	// Bounds the post-transform buffer of an instanced draw, see draw_instanced
+	enum : int { INSTANCE_PASS_VERTICES = 64 * VERTEX_CHUNK_SIZE };
+
 	Renderer();
 
 	~Renderer();
@@ -40,8 +90,43 @@ public:
 
 	void draw_indexed(size_t start, size_t num, int32_t* indices);
 
-	void set_attribute(int index, int components, size_t stride, void* ptr);
-
+	// Draws instances copies of the primitives, each with the per-instance
+	// attributes of its instance, in order. It draws what as many draw calls
+	// in a row would, but primitive assembly runs once for every instance and
+	// the rest of the pipeline once for a pass of as many instances as fit in
+	// INSTANCE_PASS_VERTICES shaded vertices, so repeating a small mesh costs
+	// little more than shading its vertices. A DepthPrePass draw removes the
+	// overdraw within each pass.
+	void draw_instanced(size_t start, size_t num, size_t instances);
+
+	void draw_indexed_instanced(size_t start, size_t num, int32_t* indices, size_t instances);
+
+	// Replays a recorded command buffer. Returns the last image it presented,
+	// or nullptr if it didn't present.
+	Framebuffer const* execute(CommandBuffer const& buffer);
+
+	// Clears the back buffer, or every sample when multisampled, to color,
+	// converted to its format, and the depth buffer to depth.
+	void clear(glm::vec4 const& color, float depth);
+
+	// Averages the samples of every pixel into the back buffer. Does nothing
+	// unless multisampled.
+	void resolve();
+
+	// Resolves, then makes the back buffer the presented image and moves on
+	// to the next colour buffer. With n buffers, a presented image is next
+	// drawn to n presents later, so with two it can be read while the
+	// following frame renders. With one, present() only marks the image as
+	// presented.
+	void present();
+
+	// A stepRate of 0 makes the attribute per vertex. n makes it per
+	// instance, moving on to the next element every n instances, and draws
+	// that aren't instanced read its first element.
+	void set_attribute(int index, int components, size_t stride, void* ptr, size_t stepRate = 0);
+
+	// Vertex shaders of large draws run on several threads at once, each
+	// shading different vertices, so they must not modify shared state.
 	void set_vertex_shader(Shader& vsh);
 
 	void set_fragment_shader(Shader& fsh);
@@ -50,7 +135,25 @@ public:
 
 	void set_depth_range(float near, float far);
 
-	void set_framebuffer(size_t w, size_t h, size_t bytesPerPixel);
+	// Colour and depth share the layout. Tiled keeps the pixels of each block
+	// the rasterisers work on together in memory, and framebuffer().pixels()
+	// still returns the contents in linear layout. The colour format is RGBA8
+	// or RGBA32F, and depth is always R32F.
+	void set_framebuffer(size_t w, size_t h, PixelFormat colorFormat, FramebufferLayout layout = FramebufferLayout::Linear);
+
+	// 4 bytes per pixel is RGBA8, 16 is RGBA32F.
+	void set_framebuffer(size_t w, size_t h, size_t bytesPerPixel, FramebufferLayout layout = FramebufferLayout::Linear);
+
+	// Number of colour buffers present() cycles through, 2 for double and 3
+	// for triple buffering. They share the one depth buffer.
+	void set_framebuffer_count(size_t count);
+
+	// 1, or MultisampleBuffer::SAMPLES for multisampling. Multisampled draws
+	// test coverage and depth at every sample but shade each pixel once, and
+	// render into multisample_buffer() rather than the back buffer, which
+	// only holds the image once resolve() or present() has run. They always
+	// use default_rasteriser, whatever rasteriser is set.
+	void set_sample_count(int samples);
 
 	void set_rasteriser(RasteriserFunc rasterf);
 
@@ -58,52 +161,281 @@ public:
 
 	void set_polygon_winding(PolygonWinding winding);
 
+	void set_render_mode(RenderMode mode);
+
+	void set_cull_mode(CullMode mode);
+
+	// LessEqual by default. Draws with a test that can pass fragments behind
+	// the stored depth get no Hi-Z rejection.
+	void set_depth_test(DepthTest test);
+
+	// Whether fragments that pass the depth test write their depth, on by
+	// default. Depth only and pre-pass draws need it on.
+	void set_depth_write(bool enabled);
+
+	// Blending and the colour write mask, applied to every colour write
+	// other than clear().
+	void set_blend_state(BlendState const& state);
+
+	// Fractional bits of the grid vertices are snapped to before coverage is
+	// computed, from MIN_SUBPIXEL_BITS to MAX_SUBPIXEL_BITS. More bits place
+	// edges more precisely at no cost per pixel.
+	void set_subpixel_bits(int bits);
+
+	// 1 rasterises every triangle on the calling thread as it is assembled,
+	// anything higher bins triangles into TILE_SIZE tiles and rasterises the
+	// tiles in parallel. Both produce identical output.
+	void set_thread_count(size_t numThreads);
+
+	// Number of post-transform cache entries, or 0 to cache the whole draw.
+	void set_vertex_cache_size(size_t numEntries);
+
+	// The back buffer, which draws render to
 	Framebuffer& framebuffer();
 
 	Framebuffer const& framebuffer() const;
 
+	// The last image present() presented, or the back buffer before the first
+	// present.
+	Framebuffer const& presented_framebuffer() const;
+
+	size_t framebuffer_count() const;
+
+	// Multisampled, the depth buffer is untyped, with a float per sample.
 	Framebuffer& depth_buffer();
 
 	Framebuffer const& depth_buffer() const;
 
+	// Only there when multisampled
+	MultisampleBuffer& multisample_buffer();
+
+	MultisampleBuffer const& multisample_buffer() const;
+
+	// Per block and per tile max depth, used by the rasterisers to reject
+	// occluded triangles and blocks. It is resynced at the start of every
+	// draw after the depth buffer is cleared or written with set_row.
+	HiZBuffer& hiz_buffer();
+
+	HiZBuffer const& hiz_buffer() const;
+
 	Viewport const& viewport() const;
 
 	PrimitiveTopology primitive_topology() const;
 
 	PolygonWinding polygon_winding() const;
 
+	RenderMode render_mode() const;
+
+	CullMode cull_mode() const;
+
+	DepthTest depth_test() const;
+
+	bool depth_write() const;
+
+	BlendState const& blend_state() const;
+
+	int subpixel_bits() const;
+
+	int sample_count() const;
+
+	// Triangles the last draw culled, by facing or for having zero area.
+	size_t culled_triangles() const;
+
+	// The pass the rasterisers are running, which is the render mode except
+	// during a DepthPrePass draw, where it is DepthOnly then ShadeEqual.
+	RenderMode raster_pass() const;
+
 	int max_attributes() const;
 
+	size_t thread_count() const;
+
+	// Hit/miss counts accumulate across draws until reset_stats() is called.
+	VertexCache& vertex_cache();
+
+	VertexCache const& vertex_cache() const;
+
+	// Block, tile and fragment counters summed over every rasterising thread.
+	// They accumulate across draws until reset_raster_stats() is called.
+	RasterStats raster_stats() const;
+
+	void reset_raster_stats();
+
+	// How many triangles were trivially accepted, trivially rejected,
+	// geometrically clipped or culled, accumulated until reset_clip_stats()
+	// is called.
+	ClipStats const& clip_stats() const;
+
+	void reset_clip_stats();
+
+	// Every pipeline counter and stage timer, gathered from the clip, raster
+	// and vertex stats. reset_pipeline_stats() resets all of them, so calling
+	// it once per frame gives per frame numbers.
+	PipelineStats pipeline_stats() const;
+
+	void reset_pipeline_stats();
+
 private:
 
+	void allocate_sample_buffers();
+
+	void update_varying_layout();
+
+	void shade_vertices();
+
+	void shade_vertex_range(size_t begin, size_t end);
+
+	void instance_attributes(size_t instance, VertexArray* attributes);
+
+	void clip_triangles();
+
+	uint32_t add_clipped_vertex(int index);
+
+	void add_visible_triangle(uint32_t s0, uint32_t s1, uint32_t s2);
+
+	void assemble_triangle(uint32_t const* slots, TriangleData& triangle) const;
+
+	void process_primitives(size_t start, size_t num, int32_t const* indices, size_t instances);
+
+	void rasterise_triangles();
+
+	void bin_triangle(TriangleData const& triangle);
+
+	void flush_triangles();
+
+	void rasterise_triangle(TriangleData const& triangle, TileRect const& tile, RasterStats& stats);
+
+	// Set by Pipeline for the length of a specialised draw, which replaces the
+	// current shaders and rasteriser. shader is the draw's functor.
+	typedef void (*VertexStageFunc) (void const* shader, size_t const* vindices, size_t count, VertexArray* attributes, VertexStreams const& output);
+	typedef void (*PipelineRasteriserFunc) (Renderer* renderer, void const* shader, TriangleData const& triangle, TileRect const& tile, RasterStats& stats);
+
 	VertexArray _attributes[MAX_ATTRIBUTES];
 
 	Viewport _viewport;
 	Framebuffer* _framebuffer;
 	Framebuffer* _depthBuffer;	
+	MultisampleBuffer* _multisampleBuffer;
+	std::vector< Framebuffer* > _colorBuffers;
+	size_t _backBuffer;
+	Framebuffer* _presented;
+	uint64_t _presentCount;
+	HiZBuffer _hiZBuffer;
 	RasteriserFunc _rasterf;
 	PrimitiveTopology _primitiveTopology;
 	PolygonWinding _winding;
+	RenderMode _renderMode;
+	RenderMode _rasterPass;
 
 	Shader* _currentVsh;
 	Shader* _currentFsh;
+
+	VertexStageFunc _vertexStage;
+	void const* _vertexStageShader;
+	PipelineRasteriserFunc _pipelineRasterf;
+	void const* _pipelineShader;
+
+	VertexCache _vertexCache;
+	size_t _instanceVertices;
+	size_t _passInstance;
+	size_t _passVertices;
+	bool _instancedAttributes;
+	std::vector< uint32_t > _triangleSlots;
+	std::vector< uint32_t > _visibleSlots;
+	std::vector< float > _vertexStreams;
+	std::vector< glm::vec4 > _clipPositions;
+	std::vector< uint32_t > _clipCodes;
+	std::vector< glm::vec4 > _windowPositions;
+	std::vector< glm::ivec2 > _snappedPositions;
+	std::vector< float > _varyingArena;
+	std::vector< int > _varyingSizes;
+	size_t _varyingComponents;
+	VertShaderFunc _inferredLayoutFunc;
+
+	Clipper _clipper;
+	ClipStats _clipStats;
+	PipelineStats _pipelineStats;
+	CullMode _cullMode;
+	DepthTest _depthTest;
+	bool _depthWrite;
+	BlendState _blendState;
+	size_t _culledTriangles;
+	int _subpixelBits;
+	int _sampleCount;
+
+	ThreadPool* _threadPool;
+	std::vector< RasterStats > _threadStats;
+	std::vector< TriangleData > _triangles;
+	std::vector< std::vector< uint32_t > > _tileBins;
+	std::vector< uint32_t > _activeTiles;
+	size_t _tilesX, _tilesY;
 };
 
 
 inline Renderer::Renderer()
-: _rasterf(default_rasteriser),
+: _framebuffer(nullptr),
+  _depthBuffer(nullptr),
+  _multisampleBuffer(nullptr),
+  _colorBuffers(1, nullptr),
+  _backBuffer(0),
+  _presented(nullptr),
+  _presentCount(0),
+  _rasterf(best_rasteriser()),
   _primitiveTopology(PrimitiveTopology::TriangleList),
-  _winding(PolygonWinding::CounterClockwise) {
+  _winding(PolygonWinding::CounterClockwise),
+  _renderMode(RenderMode::Forward),
+  _rasterPass(RenderMode::Forward),
+  _currentVsh(nullptr),
+  _currentFsh(nullptr),
+  _vertexStage(nullptr),
+  _vertexStageShader(nullptr),
+  _pipelineRasterf(nullptr),
+  _pipelineShader(nullptr),
+  _instanceVertices(0),
+  _passInstance(0),
+  _passVertices(0),
+  _instancedAttributes(false),
+  _varyingComponents(0),
+  _inferredLayoutFunc(nullptr),
+  _clipStats(),
+  _pipelineStats(),
+  _cullMode(CullMode::Back),
+  _depthTest(DepthTest::LessEqual),
+  _depthWrite(true),
+  _blendState(),
+  _culledTriangles(0),
+  _subpixelBits(DEFAULT_SUBPIXEL_BITS),
+  _sampleCount(1),
+  _threadPool(new ThreadPool(std::max(1u, std::thread::hardware_concurrency()))),
+  _tilesX(0),
+  _tilesY(0) {
 	_viewport.near = 0.0f;
 	_viewport.far = 1.0f;
+	_threadStats.resize(_threadPool->num_threads(), RasterStats());
 }
 
 inline Renderer::~Renderer() {
-	if (_framebuffer) delete _framebuffer;
+	for (Framebuffer* buffer : _colorBuffers) {
+		delete buffer;
+	}
+
 	if (_depthBuffer) delete _depthBuffer;
+	delete _multisampleBuffer;
+	delete _threadPool;
+}
+
+inline void Renderer::rasterise_triangle(TriangleData const& triangle, TileRect const& tile, RasterStats& stats) {
+	if (_pipelineRasterf != nullptr) {
+		_pipelineRasterf(this, _pipelineShader, triangle, tile, stats);
+	}
+	else if (_sampleCount > 1) {
+		default_rasteriser(this, *_currentFsh, triangle, tile, stats);
+	}
+	else {
+		_rasterf(this, *_currentFsh, triangle, tile, stats);
+	}
 }
 
-inline void Renderer::set_attribute(int index, int components, size_t stride, void *ptr) {
+inline void Renderer::set_attribute(int index, int components, size_t stride, void *ptr, size_t stepRate) {
 	assert(index >= 0);
 	assert(index < MAX_ATTRIBUTES);
 	assert(ptr != nullptr);
@@ -111,6 +443,7 @@ inline void Renderer::set_attribute(int index, int components, size_t stride, vo
 	_attributes[index].components = components;
 	_attributes[index].stride = stride;
 	_attributes[index].vertices = ptr;
+	_attributes[index].stepRate = stepRate;
 }
 
 inline void Renderer::set_vertex_shader(Shader &vsh) {
@@ -145,6 +478,45 @@ inline void Renderer::set_polygon_winding(PolygonWinding winding) {
 	_winding = winding;
 }
 
+inline void Renderer::set_render_mode(RenderMode mode) {
+	_renderMode = mode;
+}
+
+inline void Renderer::set_cull_mode(CullMode mode) {
+	_cullMode = mode;
+}
+
+inline void Renderer::set_depth_test(DepthTest test) {
+	_depthTest = test;
+}
+
+inline void Renderer::set_depth_write(bool enabled) {
+	_depthWrite = enabled;
+}
+
+inline void Renderer::set_blend_state(BlendState const& state) {
+	assert((state.writeMask & ~COLOR_WRITE_ALL) == 0);
+	_blendState = state;
+}
+
+inline void Renderer::set_subpixel_bits(int bits) {
+	assert(bits >= MIN_SUBPIXEL_BITS && bits <= MAX_SUBPIXEL_BITS);
+	_subpixelBits = bits;
+}
+
+inline void Renderer::set_thread_count(size_t numThreads) {
+	assert(numThreads > 0);
+	if (numThreads != _threadPool->num_threads()) {
+		delete _threadPool;
+		_threadPool = new ThreadPool(numThreads);
+		_threadStats.resize(numThreads, RasterStats());
+	}
+}
+
+inline void Renderer::set_vertex_cache_size(size_t numEntries) {
+	_vertexCache.set_size(numEntries);
+}
+
 inline Framebuffer& Renderer::framebuffer() {
 	return *_framebuffer;
 }
@@ -153,6 +525,14 @@ inline Framebuffer const& Renderer::framebuffer() const {
 	return *_framebuffer;
 }
 
+inline Framebuffer const& Renderer::presented_framebuffer() const {
+	return (_presented != nullptr) ? *_presented : *_framebuffer;
+}
+
+inline size_t Renderer::framebuffer_count() const {
+	return _colorBuffers.size();
+}
+
 inline Framebuffer& Renderer::depth_buffer() {
 	return *_depthBuffer;
 }
@@ -161,6 +541,24 @@ inline Framebuffer const& Renderer::depth_buffer() const {
 	return *_depthBuffer;
 }
 
+inline MultisampleBuffer& Renderer::multisample_buffer() {
+	assert(_multisampleBuffer != nullptr);
+	return *_multisampleBuffer;
+}
+
+inline MultisampleBuffer const& Renderer::multisample_buffer() const {
+	assert(_multisampleBuffer != nullptr);
+	return *_multisampleBuffer;
+}
+
+inline HiZBuffer& Renderer::hiz_buffer() {
+	return _hiZBuffer;
+}
+
+inline HiZBuffer const& Renderer::hiz_buffer() const {
+	return _hiZBuffer;
+}
+
 inline Viewport const& Renderer::viewport() const {
 	return _viewport;
 }
@@ -173,9 +571,113 @@ inline PolygonWinding Renderer::polygon_winding() const {
 	return _winding;
 }
 
+inline RenderMode Renderer::render_mode() const {
+	return _renderMode;
+}
+
+inline CullMode Renderer::cull_mode() const {
+	return _cullMode;
+}
+
+inline DepthTest Renderer::depth_test() const {
+	return _depthTest;
+}
+
+inline bool Renderer::depth_write() const {
+	return _depthWrite;
+}
+
+inline BlendState const& Renderer::blend_state() const {
+	return _blendState;
+}
+
+inline int Renderer::subpixel_bits() const {
+	return _subpixelBits;
+}
+
+inline int Renderer::sample_count() const {
+	return _sampleCount;
+}
+
+inline size_t Renderer::culled_triangles() const {
+	return _culledTriangles;
+}
+
+inline RenderMode Renderer::raster_pass() const {
+	return _rasterPass;
+}
+
 inline int Renderer::max_attributes() const {
 	return MAX_ATTRIBUTES;
 }
 
+inline size_t Renderer::thread_count() const {
+	return _threadPool->num_threads();
+}
+
+inline VertexCache& Renderer::vertex_cache() {
+	return _vertexCache;
+}
+
+inline VertexCache const& Renderer::vertex_cache() const {
+	return _vertexCache;
+}
+
+inline RasterStats Renderer::raster_stats() const {
+	RasterStats total = RasterStats();
+	for (RasterStats const& stats : _threadStats) {
+		total.blocksOutside += stats.blocksOutside;
+		total.blocksPartial += stats.blocksPartial;
+		total.blocksInside += stats.blocksInside;
+		total.tilesRejected += stats.tilesRejected;
+		total.blocksOccluded += stats.blocksOccluded;
+		total.trianglesOccluded += stats.trianglesOccluded;
+		total.fragmentsShaded += stats.fragmentsShaded;
+		total.pixelsTested += stats.pixelsTested;
+		total.depthFails += stats.depthFails;
+		total.setupCycles += stats.setupCycles;
+		total.rasteriserCycles += stats.rasteriserCycles;
+		total.shadeCycles += stats.shadeCycles;
+	}
+
+	return total;
+}
+
+inline void Renderer::reset_raster_stats() {
+	std::fill(_threadStats.begin(), _threadStats.end(), RasterStats());
+}
+
+inline ClipStats const& Renderer::clip_stats() const {
+	return _clipStats;
+}
+
+inline void Renderer::reset_clip_stats() {
+	_clipStats = ClipStats();
+}
+
+// Only the front end counters live in _pipelineStats, everything else is
+// gathered from the stats the other stages keep.
+inline PipelineStats Renderer::pipeline_stats() const {
+	RasterStats raster = raster_stats();
+	PipelineStats stats = _pipelineStats;
+	stats.trianglesRejected = _clipStats.trianglesRejected;
+	stats.trianglesClipped = _clipStats.trianglesClipped;
+	stats.trianglesCulled = _clipStats.trianglesCulled;
+	stats.pixelsTested = raster.pixelsTested;
+	stats.depthPasses = raster.pixelsTested - raster.depthFails;
+	stats.depthFails = raster.depthFails;
+	stats.fragmentShaderInvocations = raster.fragmentsShaded;
+	stats.setupCycles += raster.setupCycles;
+	stats.rasterCycles = raster.rasteriserCycles - raster.setupCycles - raster.shadeCycles;
+	stats.shadeCycles = raster.shadeCycles;
+	return stats;
+}
+
+inline void Renderer::reset_pipeline_stats() {
+	_pipelineStats = PipelineStats();
+	reset_clip_stats();
+	reset_raster_stats();
+}
+
 
 #endif // JHSR_RENDERER_HPP
@@ -4,11 +4,13 @@
 #include "VertexArray.hpp"
 #include <glm/glm.hpp>
 #include <vector>
+#include <cstring>
+#include <cassert>
 
 struct ShaderVariable
 {
-	ShaderVariable() = default;
-	ShaderVariable(ShaderVariable const& sv) : size(4) { std::memcpy(&f, &sv.f, sv.size * sizeof(float)); }
+	ShaderVariable() : f(0.0f), size(0) {}
+	ShaderVariable(ShaderVariable const& sv) : size(sv.size) { std::memcpy(&f, &sv.f, sv.size * sizeof(float)); }
 	ShaderVariable& operator=(ShaderVariable const& sv) { std::memcpy(&f, &sv.f, sv.size * sizeof(float)); size = sv.size; return *this; };
 	ShaderVariable(float f) : f(f), size(1) {}
 	ShaderVariable(glm::vec2 const& v2) : v2(v2), size(2) {}
@@ -53,20 +55,83 @@ typedef std::vector< ShaderVariable > VaryingData;
 typedef VaryingData (*VertShaderFunc) (size_t vindex, VertexArray* attributes, std::vector< ShaderVariable > const& uniforms);
 typedef glm::vec4 (*FragShaderFunc) (ShaderVariable* varyings, std::vector< ShaderVariable > const& uniforms);
 
+// Structure of arrays output of a batched vertex shader. Every stream holds one
+// float per vertex in the batch, and consecutive streams are stride floats
+// apart: position_stream(0..3) are the clip space x, y, z and w, and
+// varying_stream(i) is the i'th float of the varyings flattened in order,
+// for i up to components, the number of floats in the varying layout.
+// Every vertex of a batch belongs to the same instance, which is 0 outside
+// instanced draws.
+struct VertexStreams
+{
+	float* position_stream(int component) const { return position + (component * stride); }
+	float* varying_stream(int component) const { return varyings + (component * stride); }
+
+	float* position;
+	float* varyings;
+	size_t stride;
+	size_t components;
+	size_t instance;
+};
+
+// Shades vertices vindices[0..count) and writes vertex j's outputs to element j
+// of every output stream. Unlike VertShaderFunc the position is not part of
+// the varyings, and the varying layout is declared up front on the Shader.
+typedef void (*BatchVertShaderFunc) (size_t const* vindices, size_t count, VertexArray* attributes, std::vector< ShaderVariable > const& uniforms, VertexStreams const& output);
+
 // The thought is that since author of the shader is responsible
 // for determining how uniform data is layed out, providing a
 // straight list of shader variables is reasonable.
 struct Shader
 {
-	Shader(VertShaderFunc vsh) : vfunc(vsh) {}
-	Shader(FragShaderFunc fsh) : ffunc(fsh) {}
+	Shader(VertShaderFunc vsh) : vfunc(vsh), bfunc(nullptr), derivatives(false) {}
+	Shader(BatchVertShaderFunc bsh, std::vector< int > const& varyingSizes) : vfunc(nullptr), bfunc(bsh), varyingSizes(varyingSizes), derivatives(false) {}
+	Shader(FragShaderFunc fsh) : ffunc(fsh), bfunc(nullptr), derivatives(false) {}
 
 	std::vector< ShaderVariable > uniforms;
 	union {
 		VertShaderFunc vfunc;
 		FragShaderFunc ffunc;
 	};
+
+	// Batched vertex shaders only. varyingSizes holds the number of floats in
+	// each varying, not counting the position.
+	BatchVertShaderFunc bfunc;
+	std::vector< int > varyingSizes;
+
+	// Fragment shaders only. When set, a shader with n varyings also gets
+	// their screen space derivatives, d/dx in varyings[n..2n) and d/dy in
+	// varyings[2n..3n), for picking texture LODs.
+	bool derivatives;
 };
 
-#endif // JHSR_SHADER_HPP
+// Runs a batch through vsh, adapting per-vertex VertShaderFuncs by shading one
+// vertex at a time and scattering the results into the output streams. Those
+// read per-instance attributes like any other, but only batched shaders are
+// told the instance.
+inline void run_vertex_shader(Shader const& vsh, size_t const* vindices, size_t count, VertexArray* attributes, VertexStreams const& output) {
+	if (vsh.bfunc != nullptr) {
+		vsh.bfunc(vindices, count, attributes, vsh.uniforms, output);
+		return;
+	}
+
+	for (size_t j = 0; j < count; ++j) {
+		VaryingData result = vsh.vfunc(vindices[j], attributes, vsh.uniforms);
+		assert(result[0].size == 4);
+		for (int c = 0; c < 4; ++c) {
+			output.position_stream(c)[j] = result[0].arr[c];
+		}
+
+		size_t component = 0;
+		for (size_t i = 1; i < result.size(); ++i) {
+			assert(component + result[i].size <= output.components);
+			for (int k = 0; k < result[i].size; ++k, ++component) {
+				output.varying_stream(component)[j] = result[i].arr[k];
+			}
+		}
+
+		assert(component == output.components);
+	}
+}
 
+#endif // JHSR_SHADER_HPP
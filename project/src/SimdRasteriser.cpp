@@ -0,0 +1,228 @@
+#include "SimdRasteriser.hpp"
+#include "TriangleSetup.hpp"
+#include "Renderer.hpp"
+#include <cstring>
+
+#if JHSR_X86_SIMD
+#include <immintrin.h>
+
+// Shades the lanes of a group that passed coverage and depth in x order,
+// exactly as the scalar loop would have visited them, then merges all of
+// their colours at once. Lanes are distinct pixels, so depth values loaded
+// for the whole group stay valid while the earlier lanes write theirs.
+static inline void shade_group(Renderer* renderer, Shader const& fsh, TriangleSetup const& setup, ShaderVariable* varyings,
+                               int mask, int x, int y, float fy, float const* fx, float const* z, float const* realw, RasterStats& stats) {
+    JHSR_STATS(ScopedCycleTimer timer(stats.shadeCycles);)
+    glm::vec4 colors[BLOCK_SIZE];
+    for (int lanes = mask; lanes != 0; lanes &= lanes - 1) {
+        int lane = __builtin_ctz(lanes);
+        if (setup.writeDepth) {
+            renderer->depth_buffer().pixel< float >(x + lane, y) = z[lane];
+        }
+
+        if (setup.shade) {
+            colors[lane] = run_fragment_shader(fsh, setup, varyings, fx[lane], fy, realw[lane]);
+            ++stats.fragmentsShaded;
+        }
+    }
+
+    if (setup.shade) {
+        write_colors(renderer, setup, x, y, colors, mask);
+    }
+}
+
+// The lanes of z that pass test against depth, exactly as depth_test_passes
+// decides each
+__attribute__((target("sse2")))
+static inline __m128 depth_test_lanes(DepthTest test, __m128 z, __m128 depth) {
+    switch (test) {
+        case DepthTest::Never:        return _mm_setzero_ps();
+        case DepthTest::Less:         return _mm_cmplt_ps(z, depth);
+        case DepthTest::Equal:        return _mm_cmpeq_ps(z, depth);
+        case DepthTest::LessEqual:    return _mm_cmple_ps(z, depth);
+        case DepthTest::Greater:      return _mm_cmpgt_ps(z, depth);
+        case DepthTest::NotEqual:     return _mm_cmpneq_ps(z, depth);
+        case DepthTest::GreaterEqual: return _mm_cmpge_ps(z, depth);
+        default:                      return _mm_castsi128_ps(_mm_set1_epi32(-1));
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256 depth_test_lanes(DepthTest test, __m256 z, __m256 depth) {
+    switch (test) {
+        case DepthTest::Never:        return _mm256_setzero_ps();
+        case DepthTest::Less:         return _mm256_cmp_ps(z, depth, _CMP_LT_OQ);
+        case DepthTest::Equal:        return _mm256_cmp_ps(z, depth, _CMP_EQ_OQ);
+        case DepthTest::LessEqual:    return _mm256_cmp_ps(z, depth, _CMP_LE_OQ);
+        case DepthTest::Greater:      return _mm256_cmp_ps(z, depth, _CMP_GT_OQ);
+        case DepthTest::NotEqual:     return _mm256_cmp_ps(z, depth, _CMP_NEQ_UQ);
+        case DepthTest::GreaterEqual: return _mm256_cmp_ps(z, depth, _CMP_GE_OQ);
+        default:                      return _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    }
+}
+
+// covered holds the lanes that reached the depth test and passed the ones
+// that passed it
+static inline void count_depth_tests(int covered, int passed, RasterStats& stats) {
+    stats.pixelsTested += __builtin_popcount(covered);
+    stats.depthFails += __builtin_popcount(covered & ~passed);
+}
+
+// Loads the current depth of a group of lanes pixels starting at span,
+// without reading past the count that are inside the block
+static inline float const* depth_group(float const* span, int count, int lanes, float* tail) {
+    if (count >= lanes) {
+        return span;
+    }
+
+    std::memcpy(tail, span, count * sizeof(float));
+    return tail;
+}
+
+__attribute__((target("sse2")))
+void sse2_rasteriser(Renderer* renderer, Shader const& fsh, TriangleData const& triangle, TileRect const& tile, RasterStats& stats) {
+    enum { LANES = 4 };
+    static_assert(int(LANES) <= int(LANE_EDGE_STEPS), "lane edge values must stay in range");
+    TriangleSetup setup;
+    if (!setup_triangle(renderer, triangle, tile, setup, stats)) {
+        return;
+    }
+
+    ShaderVariable varyings[Renderer::MAX_FRAGMENT_INPUTS];
+    prepare_fragment_inputs(fsh, setup, varyings);
+    alignas(16) float fx[LANES], z[LANES], realw[LANES], tail[LANES];
+
+    // Edge values of the lanes relative to the first
+    TriangleEdges const& edges = setup.edges;
+    __m128i lane01 = _mm_setr_epi32(0, -edges.dy01, -2 * edges.dy01, -3 * edges.dy01);
+    __m128i lane12 = _mm_setr_epi32(0, -edges.dy12, -2 * edges.dy12, -3 * edges.dy12);
+    __m128i lane20 = _mm_setr_epi32(0, -edges.dy20, -2 * edges.dy20, -3 * edges.dy20);
+    __m128i zero   = _mm_setzero_si128();
+    __m128 laneX   = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    __m128 dzdx    = _mm_set1_ps(setup.dzdx);
+    __m128 dwdx    = _mm_set1_ps(setup.dwdx);
+    __m128 one     = _mm_set1_ps(1.0f);
+
+    for (BlockIterator block(setup, stats); block.next(); ) {
+        for (int y = block.y0; y <= block.y1; y += 1) {
+            float fy = float(y - setup.bounds.miny);
+            __m128 rowz = _mm_set1_ps(setup.cz + (setup.dzdy * fy));
+            __m128 roww = _mm_set1_ps(setup.cw + (setup.dwdy * fy));
+            for (int x = block.x0; x <= block.x1; x += LANES) {
+                int mask = (1 << LANES) - 1;
+                if (!block.inside) {
+                    __m128i cx01 = _mm_add_epi32(_mm_set1_epi32(lane_edge_value(edge_value(edges.c01, edges.dx01, edges.dy01, x, y))), lane01);
+                    __m128i cx12 = _mm_add_epi32(_mm_set1_epi32(lane_edge_value(edge_value(edges.c12, edges.dx12, edges.dy12, x, y))), lane12);
+                    __m128i cx20 = _mm_add_epi32(_mm_set1_epi32(lane_edge_value(edge_value(edges.c20, edges.dx20, edges.dy20, x, y))), lane20);
+                    __m128i inside = _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi32(cx01, zero), _mm_cmpgt_epi32(cx12, zero)), _mm_cmpgt_epi32(cx20, zero));
+                    mask = _mm_movemask_ps(_mm_castsi128_ps(inside));
+                }
+
+                if (block.x1 - x < LANES - 1) {
+                    mask &= (1 << (block.x1 - x + 1)) - 1;
+                }
+
+                if (mask != 0) {
+                    __m128 vfx = _mm_add_ps(_mm_set1_ps(float(x - setup.bounds.minx)), laneX);
+                    __m128 vz = _mm_add_ps(rowz, _mm_mul_ps(dzdx, vfx));
+                    __m128 currentDepth = _mm_loadu_ps(depth_group(depth_span(renderer, x, y), block.x1 - x + 1, LANES, tail));
+                    JHSR_STATS(int covered = mask;)
+                    mask &= _mm_movemask_ps(depth_test_lanes(setup.depthTest, vz, currentDepth));
+                    JHSR_STATS(count_depth_tests(covered, mask, stats);)
+                    if (mask != 0) {
+                        _mm_store_ps(fx, vfx);
+                        _mm_store_ps(z, vz);
+                        _mm_store_ps(realw, _mm_div_ps(one, _mm_add_ps(roww, _mm_mul_ps(dwdx, vfx))));
+                        shade_group(renderer, fsh, setup, varyings, mask, x, y, fy, fx, z, realw, stats);
+                        block.written = true;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Enabled per function rather than per file so that nothing else in this
+// translation unit, the shared scalar code included, picks up AVX or FMA
+// codegen that would change its results. A block row is exactly one group.
+__attribute__((target("avx2")))
+void avx2_rasteriser(Renderer* renderer, Shader const& fsh, TriangleData const& triangle, TileRect const& tile, RasterStats& stats) {
+    enum { LANES = 8 };
+    static_assert(int(LANES) == int(BLOCK_SIZE), "avx2_rasteriser handles one block row per group");
+    static_assert(int(LANES) <= int(LANE_EDGE_STEPS), "lane edge values must stay in range");
+    TriangleSetup setup;
+    if (!setup_triangle(renderer, triangle, tile, setup, stats)) {
+        return;
+    }
+
+    ShaderVariable varyings[Renderer::MAX_FRAGMENT_INPUTS];
+    prepare_fragment_inputs(fsh, setup, varyings);
+    alignas(32) float fx[LANES], z[LANES], realw[LANES], tail[LANES];
+
+    TriangleEdges const& edges = setup.edges;
+    __m256i lanes  = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i lane01 = _mm256_mullo_epi32(lanes, _mm256_set1_epi32(-edges.dy01));
+    __m256i lane12 = _mm256_mullo_epi32(lanes, _mm256_set1_epi32(-edges.dy12));
+    __m256i lane20 = _mm256_mullo_epi32(lanes, _mm256_set1_epi32(-edges.dy20));
+    __m256i zero   = _mm256_setzero_si256();
+    __m256 laneX   = _mm256_cvtepi32_ps(lanes);
+    __m256 dzdx    = _mm256_set1_ps(setup.dzdx);
+    __m256 dwdx    = _mm256_set1_ps(setup.dwdx);
+    __m256 one     = _mm256_set1_ps(1.0f);
+
+    for (BlockIterator block(setup, stats); block.next(); ) {
+        int x = block.x0;
+        int spanMask = (1 << (block.x1 - x + 1)) - 1;
+        __m256 vfx = _mm256_add_ps(_mm256_set1_ps(float(x - setup.bounds.minx)), laneX);
+        for (int y = block.y0; y <= block.y1; y += 1) {
+            int mask = spanMask;
+            if (!block.inside) {
+                __m256i cx01 = _mm256_add_epi32(_mm256_set1_epi32(lane_edge_value(edge_value(edges.c01, edges.dx01, edges.dy01, x, y))), lane01);
+                __m256i cx12 = _mm256_add_epi32(_mm256_set1_epi32(lane_edge_value(edge_value(edges.c12, edges.dx12, edges.dy12, x, y))), lane12);
+                __m256i cx20 = _mm256_add_epi32(_mm256_set1_epi32(lane_edge_value(edge_value(edges.c20, edges.dx20, edges.dy20, x, y))), lane20);
+                __m256i inside = _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(cx01, zero), _mm256_cmpgt_epi32(cx12, zero)), _mm256_cmpgt_epi32(cx20, zero));
+                mask &= _mm256_movemask_ps(_mm256_castsi256_ps(inside));
+                if (mask == 0) {
+                    continue;
+                }
+            }
+
+            float fy = float(y - setup.bounds.miny);
+            __m256 rowz = _mm256_set1_ps(setup.cz + (setup.dzdy * fy));
+            __m256 vz = _mm256_add_ps(rowz, _mm256_mul_ps(dzdx, vfx));
+            __m256 currentDepth = _mm256_loadu_ps(depth_group(depth_span(renderer, x, y), block.x1 - x + 1, LANES, tail));
+            JHSR_STATS(int covered = mask;)
+            mask &= _mm256_movemask_ps(depth_test_lanes(setup.depthTest, vz, currentDepth));
+            JHSR_STATS(count_depth_tests(covered, mask, stats);)
+            if (mask != 0) {
+                __m256 roww = _mm256_set1_ps(setup.cw + (setup.dwdy * fy));
+                _mm256_store_ps(fx, vfx);
+                _mm256_store_ps(z, vz);
+                _mm256_store_ps(realw, _mm256_div_ps(one, _mm256_add_ps(roww, _mm256_mul_ps(dwdx, vfx))));
+                shade_group(renderer, fsh, setup, varyings, mask, x, y, fy, fx, z, realw, stats);
+                block.written = true;
+            }
+        }
+    }
+}
+
+RasteriserFunc best_rasteriser() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return avx2_rasteriser;
+    }
+
+    if (__builtin_cpu_supports("sse2")) {
+        return sse2_rasteriser;
+    }
+
+    return default_rasteriser;
+}
+
+#else
+
+RasteriserFunc best_rasteriser() {
+    return default_rasteriser;
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef JHSR_SIMD_RASTERISER_HPP
+#define JHSR_SIMD_RASTERISER_HPP
+
+#include "DefaultRasteriser.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define JHSR_X86_SIMD 1
+#endif
+
+#if JHSR_X86_SIMD
+// Drop-in replacements for default_rasteriser that evaluate the edge
+// functions, z and 1/w for 4 (SSE2) or 8 (AVX2) horizontally adjacent pixels at
+// a time and only visit covered pixels. Output is bit for bit identical.
+void sse2_rasteriser(Renderer* renderer, Shader const& fsh, TriangleData const& triangle, TileRect const& tile, RasterStats& stats);
+
+void avx2_rasteriser(Renderer* renderer, Shader const& fsh, TriangleData const& triangle, TileRect const& tile, RasterStats& stats);
+#endif
+
+// The widest rasteriser the running CPU supports, falling back to
+// default_rasteriser on CPUs without a SIMD path.
+RasteriserFunc best_rasteriser();
+
+#endif // JHSR_SIMD_RASTERISER_HPP
@@ -0,0 +1,246 @@
+#include "Texture.hpp"
+#include <cmath>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JHSR_TEXTURE_SSE2 1
+#endif
+
+// Written to match what sample_batch_sse2 does lane by lane, so the scalar and
+// SIMD paths agree bit for bit: floor by truncating and stepping down, and
+// a clamp that sends NaN to 0.
+static inline int floor_int(float x) {
+	int t = int(x);
+	return t - ((float(t) > x) ? 1 : 0);
+}
+
+static inline float clamp_lod(float lod, float maxLod) {
+	return std::max(0.0f, std::min(lod, maxLod));
+}
+
+static inline int wrap_coord(TextureWrap wrap, int i, int n) {
+	if (wrap == TextureWrap::Clamp) {
+		return std::min(std::max(i, 0), n - 1);
+	}
+
+	if ((n & (n - 1)) == 0) {
+		return i & (n - 1);
+	}
+
+	int r = i % n;
+	return (r < 0) ? r + n : r;
+}
+
+static inline glm::vec4 unpack_texel(uint32_t texel) {
+	glm::vec4 bytes(float(texel & 0xff), float((texel >> 8) & 0xff), float((texel >> 16) & 0xff), float(texel >> 24));
+	return bytes * (1.0f / 255.0f);
+}
+
+Texture::Texture(size_t width, size_t height, int components, void const* data) {
+	assert(width > 0 && height > 0);
+	assert(components >= 1 && components <= 4);
+	assert(data != nullptr);
+
+	std::vector< uint32_t > linear(width * height);
+	uint8_t const* src = static_cast< uint8_t const* >(data);
+	for (size_t i = 0; i < linear.size(); ++i, src += components) {
+		uint32_t r = src[0], g = src[0], b = src[0], a = 0xff;
+		if (components == 2) {
+			a = src[1];
+		}
+		else if (components >= 3) {
+			g = src[1];
+			b = src[2];
+			a = (components == 4) ? src[3] : 0xff;
+		}
+
+		linear[i] = (a << 24) | (b << 16) | (g << 8) | r;
+	}
+
+	add_level(width, height, linear);
+
+	// Each level is a rounded 2x2 box filter of the one above. Odd sizes
+	// round down, dropping the last row or column.
+	while (width > 1 || height > 1) {
+		size_t nextWidth = std::max(size_t(1), width / 2), nextHeight = std::max(size_t(1), height / 2);
+		std::vector< uint32_t > next(nextWidth * nextHeight);
+		for (size_t y = 0; y < nextHeight; ++y) {
+			size_t y0 = std::min(2 * y, height - 1), y1 = std::min((2 * y) + 1, height - 1);
+			for (size_t x = 0; x < nextWidth; ++x) {
+				size_t x0 = std::min(2 * x, width - 1), x1 = std::min((2 * x) + 1, width - 1);
+				uint32_t texels[] = { linear[(y0 * width) + x0], linear[(y0 * width) + x1], linear[(y1 * width) + x0], linear[(y1 * width) + x1] };
+				uint32_t result = 0;
+				for (int shift = 0; shift < 32; shift += 8) {
+					uint32_t sum = 2;
+					for (uint32_t texel : texels) {
+						sum += (texel >> shift) & 0xff;
+					}
+
+					result |= (sum / 4) << shift;
+				}
+
+				next[(y * nextWidth) + x] = result;
+			}
+		}
+
+		linear.swap(next);
+		width = nextWidth;
+		height = nextHeight;
+		add_level(width, height, linear);
+	}
+}
+
+void Texture::add_level(size_t width, size_t height, std::vector< uint32_t > const& linear) {
+	Level level;
+	level.width = width;
+	level.height = height;
+	level.tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	size_t tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+	level.texels.assign(level.tilesX * tilesY * TILE_SIZE * TILE_SIZE, 0);
+	for (size_t y = 0; y < height; ++y) {
+		for (size_t x = 0; x < width; ++x) {
+			level.texels[texel_index(level, x, y)] = linear[(y * width) + x];
+		}
+	}
+
+	_levels.push_back(std::move(level));
+}
+
+float Texture::lod(glm::vec2 const& duvdx, glm::vec2 const& duvdy) const {
+	glm::vec2 size(static_cast< float >(width()), static_cast< float >(height()));
+	glm::vec2 dx = duvdx * size, dy = duvdy * size;
+	float rho2 = std::max(glm::dot(dx, dx), glm::dot(dy, dy));
+	return 0.5f * std::log2(rho2);
+}
+
+Texture::Footprint Texture::footprint(Level const& level, float u, float v, bool bilinear) {
+	float x = u * float(level.width);
+	float y = v * float(level.height);
+	if (bilinear) {
+		x = x - 0.5f;
+		y = y - 0.5f;
+	}
+
+	Footprint result;
+	result.x0 = floor_int(x);
+	result.y0 = floor_int(y);
+	result.tx = x - float(result.x0);
+	result.ty = y - float(result.y0);
+	return result;
+}
+
+uint32_t Texture::fetch(Sampler const& sampler, Level const& level, int x, int y) const {
+	return level.texels[texel_index(level, wrap_coord(sampler.wrap, x, int(level.width)), wrap_coord(sampler.wrap, y, int(level.height)))];
+}
+
+glm::vec4 Texture::filter(Sampler const& sampler, Level const& level, Footprint const& footprint) const {
+	if (sampler.filter == TextureFilter::Nearest) {
+		return unpack_texel(fetch(sampler, level, footprint.x0, footprint.y0));
+	}
+
+	glm::vec4 t00 = unpack_texel(fetch(sampler, level, footprint.x0, footprint.y0));
+	glm::vec4 t10 = unpack_texel(fetch(sampler, level, footprint.x0 + 1, footprint.y0));
+	glm::vec4 t01 = unpack_texel(fetch(sampler, level, footprint.x0, footprint.y0 + 1));
+	glm::vec4 t11 = unpack_texel(fetch(sampler, level, footprint.x0 + 1, footprint.y0 + 1));
+	glm::vec4 bottom = t00 + ((t10 - t00) * footprint.tx);
+	glm::vec4 top = t01 + ((t11 - t01) * footprint.tx);
+	return bottom + ((top - bottom) * footprint.ty);
+}
+
+glm::vec4 Texture::sample(Sampler const& sampler, glm::vec2 const& uv, float lod) const {
+	lod = clamp_lod(lod, float(levels() - 1));
+	if (sampler.filter == TextureFilter::Trilinear) {
+		int l0 = int(lod);
+		int l1 = std::min(l0 + 1, levels() - 1);
+		float weight = lod - float(l0);
+		glm::vec4 c0 = filter(sampler, _levels[l0], footprint(_levels[l0], uv.x, uv.y, true));
+		glm::vec4 c1 = filter(sampler, _levels[l1], footprint(_levels[l1], uv.x, uv.y, true));
+		return c0 + ((c1 - c0) * weight);
+	}
+
+	Level const& level = _levels[int(lod + 0.5f)];
+	return filter(sampler, level, footprint(level, uv.x, uv.y, sampler.filter == TextureFilter::Bilinear));
+}
+
+glm::vec4 Texture::sample(Sampler const& sampler, glm::vec2 const& uv, glm::vec2 const& duvdx, glm::vec2 const& duvdy) const {
+	return sample(sampler, uv, lod(duvdx, duvdy));
+}
+
+void Texture::sample_batch(Sampler const& sampler, float const* u, float const* v, float const* lod, size_t count, glm::vec4* result) const {
+#if JHSR_TEXTURE_SSE2
+	static bool const hasSse2 = (__builtin_cpu_init(), __builtin_cpu_supports("sse2"));
+	if (hasSse2) {
+		sample_batch_sse2(sampler, u, v, lod, count, result);
+		return;
+	}
+#endif
+	sample_batch_scalar(sampler, u, v, lod, count, result);
+}
+
+void Texture::sample_batch_scalar(Sampler const& sampler, float const* u, float const* v, float const* lod, size_t count, glm::vec4* result) const {
+	for (size_t i = 0; i < count; ++i) {
+		result[i] = sample(sampler, glm::vec2(u[i], v[i]), lod[i]);
+	}
+}
+
+#if JHSR_TEXTURE_SSE2
+// Levels, footprints and trilinear weights for four fragments at a time. The
+// texel fetches are scalar either way, SSE2 has no gather.
+__attribute__((target("sse2")))
+void Texture::sample_batch_sse2(Sampler const& sampler, float const* u, float const* v, float const* lod, size_t count, glm::vec4* result) const {
+	enum { LANES = 4 };
+	bool trilinear = (sampler.filter == TextureFilter::Trilinear);
+	bool bilinear = (sampler.filter != TextureFilter::Nearest);
+	int maxLevel = levels() - 1;
+	__m128 maxLod = _mm_set1_ps(float(maxLevel));
+	__m128 zero = _mm_setzero_ps();
+	__m128 half = _mm_set1_ps(0.5f);
+	alignas(16) int level[LANES], x0[LANES], y0[LANES];
+	alignas(16) float weight[LANES], tx[LANES], ty[LANES];
+
+	size_t i = 0;
+	for (; i + LANES <= count; i += LANES) {
+		__m128 l = _mm_max_ps(_mm_min_ps(maxLod, _mm_loadu_ps(lod + i)), zero);
+		__m128i nearest = _mm_cvttps_epi32(trilinear ? l : _mm_add_ps(l, half));
+		_mm_store_si128(reinterpret_cast< __m128i* >(level), nearest);
+		_mm_store_ps(weight, _mm_sub_ps(l, _mm_cvtepi32_ps(nearest)));
+
+		// The second pass is the level below for trilinear filtering
+		for (int pass = 0; pass < (trilinear ? 2 : 1); ++pass) {
+			if (pass == 1) {
+				for (int lane = 0; lane < LANES; ++lane) {
+					level[lane] = std::min(level[lane] + 1, maxLevel);
+				}
+			}
+
+			Level const* laneLevels[LANES] = { &_levels[level[0]], &_levels[level[1]], &_levels[level[2]], &_levels[level[3]] };
+			__m128 w = _mm_setr_ps(float(laneLevels[0]->width), float(laneLevels[1]->width), float(laneLevels[2]->width), float(laneLevels[3]->width));
+			__m128 h = _mm_setr_ps(float(laneLevels[0]->height), float(laneLevels[1]->height), float(laneLevels[2]->height), float(laneLevels[3]->height));
+			__m128 x = _mm_mul_ps(_mm_loadu_ps(u + i), w);
+			__m128 y = _mm_mul_ps(_mm_loadu_ps(v + i), h);
+			if (bilinear) {
+				x = _mm_sub_ps(x, half);
+				y = _mm_sub_ps(y, half);
+			}
+
+			// floor_int: truncate, then step down where that rounded up
+			__m128i ix = _mm_cvttps_epi32(x);
+			__m128i iy = _mm_cvttps_epi32(y);
+			ix = _mm_add_epi32(ix, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(ix), x)));
+			iy = _mm_add_epi32(iy, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(iy), y)));
+			_mm_store_si128(reinterpret_cast< __m128i* >(x0), ix);
+			_mm_store_si128(reinterpret_cast< __m128i* >(y0), iy);
+			_mm_store_ps(tx, _mm_sub_ps(x, _mm_cvtepi32_ps(ix)));
+			_mm_store_ps(ty, _mm_sub_ps(y, _mm_cvtepi32_ps(iy)));
+
+			for (int lane = 0; lane < LANES; ++lane) {
+				Footprint footprint = { x0[lane], y0[lane], tx[lane], ty[lane] };
+				glm::vec4 color = filter(sampler, *laneLevels[lane], footprint);
+				glm::vec4& out = result[i + lane];
+				out = (pass == 0) ? color : out + ((color - out) * weight[lane]);
+			}
+		}
+	}
+
+	sample_batch_scalar(sampler, u + i, v + i, lod + i, count - i, result + i);
+}
+#endif
@@ -0,0 +1,131 @@
+#ifndef JHSR_TEXTURE_HPP
+#define JHSR_TEXTURE_HPP
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+
+// Nearest takes the nearest texel of the nearest mip level, Bilinear blends
+// the four texels around the sample point in the nearest level, and Trilinear
+// blends bilinear samples of the two levels either side of the LOD.
+enum class TextureFilter
+{
+	Nearest,
+	Bilinear,
+	Trilinear
+};
+
+enum class TextureWrap
+{
+	Repeat,
+	Clamp
+};
+
+struct Sampler
+{
+	Sampler(TextureFilter filter = TextureFilter::Trilinear, TextureWrap wrap = TextureWrap::Repeat) : filter(filter), wrap(wrap) {}
+
+	TextureFilter filter;
+	TextureWrap wrap;
+};
+
+// RGBA8 texture with a full mip chain, built when the texture is created.
+// Every level is stored as TILE_SIZE square tiles of one cache line each, so
+// a bilinear footprint usually reads one line, whichever way the texture is
+// walked across the screen. (0, 0) is the outer corner of the first texel of
+// the source data and (1, 1) the outer corner of the last.
+class Texture
+{
+public:
+
+	enum : int { TILE_SIZE = 4 };
+
+	// data holds width * height texels of components bytes each, row by row:
+	// 1 is grey, 2 grey and alpha, 3 RGB and 4 RGBA.
+	Texture(size_t width, size_t height, int components, void const* data);
+
+	int levels() const;
+
+	size_t width(int level = 0) const;
+
+	size_t height(int level = 0) const;
+
+	// Packed like an RGBA8 framebuffer pixel, red in the low byte
+	uint32_t texel(int level, size_t x, size_t y) const;
+
+	// Level of detail of a pixel whose texture coordinates change by duvdx
+	// across it and duvdy up it.
+	float lod(glm::vec2 const& duvdx, glm::vec2 const& duvdy) const;
+
+	glm::vec4 sample(Sampler const& sampler, glm::vec2 const& uv, float lod) const;
+
+	glm::vec4 sample(Sampler const& sampler, glm::vec2 const& uv, glm::vec2 const& duvdx, glm::vec2 const& duvdy) const;
+
+	// Samples count fragments, fragment i at (u[i], v[i]) with level of
+	// detail lod[i], into result[i]. Gives exactly what sample() would, but
+	// picks levels and texel footprints four fragments at a time when the CPU
+	// has SSE2.
+	void sample_batch(Sampler const& sampler, float const* u, float const* v, float const* lod, size_t count, glm::vec4* result) const;
+
+private:
+
+	struct Level
+	{
+		size_t width, height, tilesX;
+		std::vector< uint32_t > texels;
+	};
+
+	// The texels a sample reads in one level, before wrapping: x0 and y0 are
+	// the nearest texel for nearest filtering, or the one below and left of
+	// the sample point for bilinear, which is tx and ty of the way to x0 + 1,
+	// y0 + 1.
+	struct Footprint
+	{
+		int x0, y0;
+		float tx, ty;
+	};
+
+	void add_level(size_t width, size_t height, std::vector< uint32_t > const& linear);
+
+	static size_t texel_index(Level const& level, size_t x, size_t y);
+
+	static Footprint footprint(Level const& level, float u, float v, bool bilinear);
+
+	uint32_t fetch(Sampler const& sampler, Level const& level, int x, int y) const;
+
+	glm::vec4 filter(Sampler const& sampler, Level const& level, Footprint const& footprint) const;
+
+	void sample_batch_scalar(Sampler const& sampler, float const* u, float const* v, float const* lod, size_t count, glm::vec4* result) const;
+
+	void sample_batch_sse2(Sampler const& sampler, float const* u, float const* v, float const* lod, size_t count, glm::vec4* result) const;
+
+	std::vector< Level > _levels;
+};
+
+
+inline int Texture::levels() const {
+	return int(_levels.size());
+}
+
+inline size_t Texture::width(int level) const {
+	return _levels[level].width;
+}
+
+inline size_t Texture::height(int level) const {
+	return _levels[level].height;
+}
+
+inline size_t Texture::texel_index(Level const& level, size_t x, size_t y) {
+	size_t tile = ((y / TILE_SIZE) * level.tilesX) + (x / TILE_SIZE);
+	return (tile * TILE_SIZE * TILE_SIZE) + ((y % TILE_SIZE) * TILE_SIZE) + (x % TILE_SIZE);
+}
+
+inline uint32_t Texture::texel(int level, size_t x, size_t y) const {
+	assert(level >= 0 && level < levels());
+	assert(x < _levels[level].width && y < _levels[level].height);
+	return _levels[level].texels[texel_index(_levels[level], x, y)];
+}
+
+#endif // JHSR_TEXTURE_HPP
@@ -0,0 +1,83 @@
+#include "ThreadPool.hpp"
+#include <cassert>
+
+ThreadPool::ThreadPool(size_t numThreads)
+: _task(nullptr),
+  _count(0),
+  _next(0),
+  _generation(0),
+  _activeWorkers(0),
+  _shutdown(false) {
+	assert(numThreads > 0);
+	for (size_t i = 1; i < numThreads; ++i) {
+		_workers.push_back(std::thread(&ThreadPool::worker_loop, this, i));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard< std::mutex > lock(_mutex);
+		_shutdown = true;
+	}
+
+	_wakeCondition.notify_all();
+	for (std::thread& worker : _workers) {
+		worker.join();
+	}
+}
+
+void ThreadPool::parallel_for(size_t count, Task const& task) {
+	if (_workers.empty() || count <= 1) {
+		for (size_t i = 0; i < count; ++i) {
+			task(i, 0);
+		}
+
+		return;
+	}
+
+	{
+		std::lock_guard< std::mutex > lock(_mutex);
+		_task = &task;
+		_count = count;
+		_next = 0;
+		_activeWorkers = _workers.size();
+		++_generation;
+	}
+
+	_wakeCondition.notify_all();
+	run_tasks(0);
+
+	// Every worker checks in once per generation, so none of them can still
+	// be holding a pointer to task after this returns.
+	std::unique_lock< std::mutex > lock(_mutex);
+	_doneCondition.wait(lock, [this] { return _activeWorkers == 0; });
+	_task = nullptr;
+}
+
+void ThreadPool::worker_loop(size_t threadIndex) {
+	size_t seenGeneration = 0;
+	for (;;) {
+		{
+			std::unique_lock< std::mutex > lock(_mutex);
+			_wakeCondition.wait(lock, [&] { return _shutdown || _generation != seenGeneration; });
+			if (_shutdown) {
+				return;
+			}
+
+			seenGeneration = _generation;
+		}
+
+		run_tasks(threadIndex);
+
+		std::lock_guard< std::mutex > lock(_mutex);
+		if (--_activeWorkers == 0) {
+			_doneCondition.notify_one();
+		}
+	}
+}
+
+void ThreadPool::run_tasks(size_t threadIndex) {
+	for (size_t i = _next++; i < _count; i = _next++) {
+		(*_task)(i, threadIndex);
+	}
+}
@@ -0,0 +1,57 @@
+#ifndef JHSR_THREADPOOL_HPP
+#define JHSR_THREADPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that execute parallel_for loops. The calling
+// thread takes part in every loop, so a pool of N threads spawns N - 1 workers.
+// Indices are handed out dynamically, which keeps uneven work (e.g. tiles with
+// very different triangle counts) balanced across threads.
+class ThreadPool
+{
+public:
+
+	// index is the loop iteration, threadIndex is in [0, num_threads())
+	typedef std::function< void (size_t index, size_t threadIndex) > Task;
+
+	explicit ThreadPool(size_t numThreads);
+
+	~ThreadPool();
+
+	size_t num_threads() const;
+
+	// Runs task for every index in [0, count) and returns once all are done.
+	void parallel_for(size_t count, Task const& task);
+
+private:
+
+	ThreadPool(ThreadPool const&) = delete;
+	ThreadPool& operator=(ThreadPool const&) = delete;
+
+	void worker_loop(size_t threadIndex);
+
+	void run_tasks(size_t threadIndex);
+
+	std::vector< std::thread > _workers;
+	std::mutex _mutex;
+	std::condition_variable _wakeCondition;
+	std::condition_variable _doneCondition;
+	Task const* _task;
+	size_t _count;
+	std::atomic< size_t > _next;
+	size_t _generation;
+	size_t _activeWorkers;
+	bool _shutdown;
+};
+
+
+inline size_t ThreadPool::num_threads() const {
+	return _workers.size() + 1;
+}
+
+#endif // JHSR_THREADPOOL_HPP
@@ -0,0 +1,351 @@
+#ifndef JHSR_TRIANGLESETUP_HPP
+#define JHSR_TRIANGLESETUP_HPP
+
+#include "Renderer.hpp"
+#include "DefaultRasteriser.hpp"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+enum { BLOCK_SIZE = Renderer::BLOCK_SIZE };
+static_assert(Framebuffer::MICRO_TILE_SIZE % BLOCK_SIZE == 0, "block rows must be contiguous in tiled framebuffers");
+
+enum class BlockCoverage
+{
+    Outside,
+    Partial,
+    Inside
+};
+
+// Fixed point edge functions of a snapped triangle, with the fill convention
+// folded into the constants. Pixel (x, y) is covered when all three of
+// edgeN(x, y) = cN + dxN * y - dyN * x are greater than zero. The deltas are
+// in subpixels and the constants in pixel units, and edge values need 64
+// bits beyond 4K targets or at finer subpixel precision.
+struct TriangleEdges
+{
+    int32_t dx01, dx12, dx20;
+    int32_t dy01, dy12, dy20;
+    int64_t c01, c12, c20;
+};
+
+void setup_edges(TriangleData const& triangle, int subpixelBits, TriangleEdges& edges);
+
+// Edges of each sample of the multisample pattern: sample s of pixel (x, y)
+// is covered when all three edges of samples[s] are positive at (x, y). The
+// samples only differ in their constants, and outer and inner take the
+// largest and smallest of them. Outer is positive at every pixel with a
+// covered sample, and inner only at pixels whose samples are all covered.
+void setup_sample_edges(TriangleData const& triangle, int subpixelBits, TriangleEdges* samples, TriangleEdges& outer, TriangleEdges& inner);
+
+inline int64_t edge_value(int64_t c, int32_t dx, int32_t dy, int x, int y) {
+    return c + (int64_t(dx) * y) - (int64_t(dy) * x);
+}
+
+// An edge value narrowed to 32 bits for SIMD lanes that add up to
+// LANE_EDGE_STEPS multiples of -dy to it. Deltas are bounded by the largest
+// target plus the guard band, far below 2^30 / LANE_EDGE_STEPS subpixels, so
+// clamping to +-2^30 keeps the sign of every lane and is exact otherwise.
+enum { LANE_EDGE_STEPS = 8 };
+
+static_assert(int64_t(Renderer::MAX_FRAMEBUFFER_SIZE + (2 * Clipper::GUARD_BAND)) * (1 << Renderer::MAX_SUBPIXEL_BITS) * LANE_EDGE_STEPS < (1 << 30), "edge deltas too large for 32-bit lanes");
+
+inline int32_t lane_edge_value(int64_t value) {
+    return int32_t(std::max(int64_t(-(1 << 30)), std::min(value, int64_t(1 << 30))));
+}
+
+// Edge functions are linear, so an edge is positive at every pixel of a block
+// when it is positive at the four corner pixels, and at none of them when it
+// is positive at none of the corners.
+inline BlockCoverage classify_edge(int64_t c, int32_t dx, int32_t dy, int x0, int y0, int x1, int y1) {
+    int64_t e00 = edge_value(c, dx, dy, x0, y0);
+    int64_t e10 = edge_value(c, dx, dy, x1, y0);
+    int64_t e01 = edge_value(c, dx, dy, x0, y1);
+    int64_t e11 = edge_value(c, dx, dy, x1, y1);
+    if (std::max(std::max(e00, e10), std::max(e01, e11)) <= 0) return BlockCoverage::Outside;
+    if (std::min(std::min(e00, e10), std::min(e01, e11)) > 0) return BlockCoverage::Inside;
+    return BlockCoverage::Partial;
+}
+
+// Classifies the pixels of the inclusive rect [x0, x1] x [y0, y1]
+inline BlockCoverage classify_block(TriangleEdges const& edges, int x0, int y0, int x1, int y1) {
+    BlockCoverage e01 = classify_edge(edges.c01, edges.dx01, edges.dy01, x0, y0, x1, y1);
+    BlockCoverage e12 = classify_edge(edges.c12, edges.dx12, edges.dy12, x0, y0, x1, y1);
+    BlockCoverage e20 = classify_edge(edges.c20, edges.dx20, edges.dy20, x0, y0, x1, y1);
+    if (e01 == BlockCoverage::Outside || e12 == BlockCoverage::Outside || e20 == BlockCoverage::Outside) return BlockCoverage::Outside;
+    if (e01 == BlockCoverage::Inside && e12 == BlockCoverage::Inside && e20 == BlockCoverage::Inside) return BlockCoverage::Inside;
+    return BlockCoverage::Partial;
+}
+
+// Everything a rasteriser needs to traverse one triangle within one tile.
+// Shared by default_rasteriser and the SIMD rasterisers so that they agree on
+// coverage, depth and interpolation down to the last bit.
+struct TriangleSetup
+{
+    // Whole triangle bounds, which anchor the z, 1/w and varying gradients
+    TileRect bounds;
+
+    // Traversal rect, the bounds clipped to the tile
+    int minx, miny, maxx, maxy;
+
+    // Multisampled, edges are the outer edges of the samples
+    TriangleEdges edges;
+
+    HiZBuffer* hiZ;
+    Framebuffer const* depthBuffer;
+
+    // The depth test of the current pass, and what it does with fragments
+    // that pass it
+    DepthTest depthTest;
+    bool writeDepth, shade;
+
+    // Whether blocks behind the Hi-Z buffer can be skipped, which holds when
+    // the depth test never passes fragments behind the stored depth
+    bool occlusionCull;
+
+    // How colours are merged into the colour target, which is RGBA32F or
+    // taken as RGBA8. overwriteColor is set when merging is a plain store.
+    BlendState const* blend;
+    bool overwriteColor;
+    PixelFormat colorFormat;
+
+    float dzdx, dzdy, cz;
+    float dwdx, dwdy, cw;
+
+    // Multisampled targets only. Sample s has edges sampleEdges[s] and z is
+    // the pixel centre's plus sampleDz[s]. sampleMinDz is the smallest of
+    // those, and 0 for single sampled targets.
+    bool multisampled;
+    TriangleEdges sampleEdges[MultisampleBuffer::SAMPLES];
+    TriangleEdges innerEdges;
+    float sampleDz[MultisampleBuffer::SAMPLES];
+    float sampleMinDz;
+
+    // The varyings times 1/w at the bounds' corner, and their gradients,
+    // packed as the triangle's varyings are. Each array runs on for
+    // VARYING_PADDING zeroed floats so that a varying's components can be
+    // stepped four at a time whatever its size.
+    enum { VARYING_PADDING = 3 };
+    int const* varyingSizes;
+    int numVaryings;
+    int numComponents;
+    float interpolatedVaryings[Renderer::MAX_VARYING_COMPONENTS + VARYING_PADDING];
+    float xgradients[Renderer::MAX_VARYING_COMPONENTS + VARYING_PADDING];
+    float ygradients[Renderer::MAX_VARYING_COMPONENTS + VARYING_PADDING];
+};
+
+// Returns false if the triangle doesn't touch the tile, or is behind
+// everything already drawn there.
+bool setup_triangle(Renderer* renderer, TriangleData const& triangle, TileRect const& tile, TriangleSetup& setup, RasterStats& stats);
+
+// Smallest z the triangle's plane takes over the inclusive rect, evaluated
+// exactly as the rasterisers evaluate per pixel z. Rounding is monotonic, so
+// the smallest value is always at the corner the gradients point away from,
+// and at that corner's lowest sample when multisampled.
+inline float min_depth(TriangleSetup const& setup, int x0, int y0, int x1, int y1) {
+    float fx = float((setup.dzdx < 0.0f ? x1 : x0) - setup.bounds.minx);
+    float fy = float((setup.dzdy < 0.0f ? y1 : y0) - setup.bounds.miny);
+    float rowz = setup.cz + (setup.dzdy * fy);
+    return (rowz + (setup.dzdx * fx)) + setup.sampleMinDz;
+}
+
+// Depth of pixel (x, y) onwards, contiguous to the end of its block row in
+// either framebuffer layout. The depth buffer is always one float per pixel.
+inline float const* depth_span(Renderer* renderer, int x, int y) {
+    return &renderer->depth_buffer().pixel< float >(x, y);
+}
+
+// The same for multisampled depth, MultisampleBuffer::SAMPLES floats per pixel
+inline float* sample_depth_span(Renderer* renderer, int x, int y) {
+    return static_cast< float* >(renderer->depth_buffer().pixel_address(x, y));
+}
+
+// Walks the traversal rect in screen aligned BLOCK_SIZE x BLOCK_SIZE blocks,
+// clipped to the rect. Blocks outside the triangle, or behind the Hi-Z buffer
+// when the depth test allows it, are skipped, and inside is set when every
+// pixel of the current block is covered, in which case its pixels need no
+// edge tests. Rasterisers set written after storing depth in the current
+// block so its Hi-Z cell is refreshed before moving on.
+class BlockIterator
+{
+public:
+
+    BlockIterator(TriangleSetup const& setup, RasterStats& stats);
+
+    // Advances to the next block that isn't rejected, false once done
+    bool next();
+
+    int x0, y0, x1, y1;
+    bool inside;
+    bool written;
+
+private:
+
+    TriangleSetup const& _setup;
+    RasterStats& _stats;
+    int _bx, _by;
+};
+
+
+inline BlockIterator::BlockIterator(TriangleSetup const& setup, RasterStats& stats)
+: written(false), _setup(setup), _stats(stats), _bx((setup.minx & ~(BLOCK_SIZE - 1)) - BLOCK_SIZE), _by(setup.miny & ~(BLOCK_SIZE - 1)) {
+
+}
+
+inline bool BlockIterator::next() {
+    if (written && _setup.writeDepth) {
+        _setup.hiZ->update_block(*_setup.depthBuffer, _bx / BLOCK_SIZE, _by / BLOCK_SIZE);
+        written = false;
+    }
+
+    for (;;) {
+        _bx += BLOCK_SIZE;
+        if (_bx > _setup.maxx) {
+            _bx = _setup.minx & ~(BLOCK_SIZE - 1);
+            _by += BLOCK_SIZE;
+        }
+
+        if (_by > _setup.maxy) {
+            return false;
+        }
+
+        x0 = std::max(_bx, _setup.minx);
+        y0 = std::max(_by, _setup.miny);
+        x1 = std::min(_bx + BLOCK_SIZE - 1, _setup.maxx);
+        y1 = std::min(_by + BLOCK_SIZE - 1, _setup.maxy);
+        if (_setup.occlusionCull && (min_depth(_setup, x0, y0, x1, y1) > _setup.hiZ->block_max(_bx / BLOCK_SIZE, _by / BLOCK_SIZE))) {
+            ++_stats.blocksOccluded;
+            continue;
+        }
+
+        BlockCoverage coverage = classify_block(_setup.edges, x0, y0, x1, y1);
+        if (coverage == BlockCoverage::Outside) {
+            ++_stats.blocksOutside;
+            continue;
+        }
+
+        inside = (coverage == BlockCoverage::Inside);
+        ++(inside ? _stats.blocksInside : _stats.blocksPartial);
+        return true;
+    }
+}
+
+inline bool depth_test(TriangleSetup const& setup, float z, float currentDepth) {
+    return depth_test_passes(setup.depthTest, z, currentDepth);
+}
+
+// Merges color into pixel (x, y), storing it directly when that's all
+// merging would do
+inline void write_color(Renderer* renderer, TriangleSetup const& setup, int x, int y, glm::vec4 const& color) {
+    if (!setup.overwriteColor) {
+        merge_colors(*setup.blend, setup.colorFormat, renderer->framebuffer().pixel_address(x, y), &color, 1);
+    }
+    else if (setup.colorFormat == PixelFormat::RGBA32F) {
+        renderer->framebuffer().pixel< glm::vec4 >(x, y) = color;
+    }
+    else {
+        renderer->framebuffer().pixel< uint32_t >(x, y) = pack_rgba8(color);
+    }
+}
+
+// Merges colors[i] into pixel (x + i, y) for every bit i of mask, all of
+// them in the block row of (x, y), which is contiguous in either layout
+inline void write_colors(Renderer* renderer, TriangleSetup const& setup, int x, int y, glm::vec4 const* colors, int mask) {
+    merge_colors(*setup.blend, setup.colorFormat, renderer->framebuffer().pixel_address(x, y), colors, mask);
+}
+
+// Multisampled colour goes to the samples in mask
+inline void write_samples(Renderer* renderer, TriangleSetup const& setup, int x, int y, int mask, glm::vec4 const& color) {
+    MultisampleBuffer& samples = renderer->multisample_buffer();
+    if (!setup.overwriteColor) {
+        glm::vec4 const colors[MultisampleBuffer::SAMPLES] = { color, color, color, color };
+        void* target = samples.fragment_span(x, y, mask);
+        merge_colors(*setup.blend, setup.colorFormat, target, colors, mask);
+    }
+    else if (setup.colorFormat == PixelFormat::RGBA32F) {
+        samples.write(x, y, mask, color);
+    }
+    else {
+        samples.write(x, y, mask, pack_rgba8(color));
+    }
+}
+
+// Sizes the fragment shader inputs for the triangle's varyings, and their
+// derivatives if the shader asks for them. Rasterisers call this once per
+// triangle, before the first run_fragment_shader.
+inline void prepare_fragment_inputs(Shader const& fsh, TriangleSetup const& setup, ShaderVariable* varyings) {
+    int n = setup.numVaryings;
+    for (int i = 0; i < n; ++i) {
+        varyings[i].size = setup.varyingSizes[i];
+        if (fsh.derivatives) {
+            varyings[n + i].size = varyings[(2 * n) + i].size = setup.varyingSizes[i];
+        }
+    }
+}
+
+// Interpolates the varyings at fx and fy, which are x and y relative to
+// setup.bounds, along with their derivatives if the shader asks for them,
+// and runs the fragment shader. Components are evaluated four at a time
+// from the packed setup straight into the inputs, whose ShaderVariables
+// have room for the lanes past each varying's size, and both paths do the
+// same arithmetic per component.
+inline glm::vec4 run_fragment_shader(Shader const& fsh, TriangleSetup const& setup, ShaderVariable* varyings, float fx, float fy, float realw) {
+    static_assert(sizeof(ShaderVariable::arr) / sizeof(float) % 4 == 0, "inputs are written four floats at a time");
+    float const* cv = setup.interpolatedVaryings;
+    float const* dvdx = setup.xgradients;
+    float const* dvdy = setup.ygradients;
+    int n = setup.numVaryings;
+#if defined(__SSE2__)
+    __m128 vfx = _mm_set1_ps(fx), vfy = _mm_set1_ps(fy), vw = _mm_set1_ps(realw);
+    __m128 dwdx = _mm_set1_ps(setup.dwdx), dwdy = _mm_set1_ps(setup.dwdy);
+#endif
+    for (int i = 0, offset = 0; i < n; offset += setup.varyingSizes[i++]) {
+        for (int j = 0; j < setup.varyingSizes[i]; j += 4) {
+            int k = offset + j;
+            float* v = varyings[i].arr + j;
+
+            // v = a * realw where a and 1 / realw are linear in x and y, so
+            // dv/dx = (da/dx - v * d(1/realw)/dx) * realw, and likewise for y.
+#if defined(__SSE2__)
+            __m128 gx = _mm_loadu_ps(dvdx + k), gy = _mm_loadu_ps(dvdy + k);
+            __m128 value = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_loadu_ps(cv + k), _mm_mul_ps(gx, vfx)), _mm_mul_ps(gy, vfy)), vw);
+            _mm_storeu_ps(v, value);
+            if (fsh.derivatives) {
+                _mm_storeu_ps(varyings[n + i].arr + j, _mm_mul_ps(_mm_sub_ps(gx, _mm_mul_ps(value, dwdx)), vw));
+                _mm_storeu_ps(varyings[(2 * n) + i].arr + j, _mm_mul_ps(_mm_sub_ps(gy, _mm_mul_ps(value, dwdy)), vw));
+            }
+#else
+            for (int c = 0; c < 4; ++c) {
+                v[c] = (cv[k + c] + (dvdx[k + c] * fx) + (dvdy[k + c] * fy)) * realw;
+                if (fsh.derivatives) {
+                    varyings[n + i].arr[j + c] = (dvdx[k + c] - (v[c] * setup.dwdx)) * realw;
+                    varyings[(2 * n) + i].arr[j + c] = (dvdy[k + c] - (v[c] * setup.dwdy)) * realw;
+                }
+            }
+#endif
+        }
+    }
+
+    return fsh.ffunc(varyings, fsh.uniforms);
+}
+
+// Writes the fragment at (x, y) as the current pass dictates: depth if the
+// pass writes it, then, unless the pass is depth only, runs the fragment
+// shader and writes colour. z has already passed the depth test.
+inline void shade_fragment(Renderer* renderer, Shader const& fsh, TriangleSetup const& setup, ShaderVariable* varyings, int x, int y, float fx, float fy, float z, float realw, RasterStats& stats) {
+    if (setup.writeDepth) {
+        renderer->depth_buffer().pixel< float >(x, y) = z;
+    }
+
+    if (!setup.shade) {
+        return;
+    }
+
+    write_color(renderer, setup, x, y, run_fragment_shader(fsh, setup, varyings, fx, fy, realw));
+    ++stats.fragmentsShaded;
+}
+
+#endif // JHSR_TRIANGLESETUP_HPP
@@ -2,23 +2,35 @@
 #define JHSR_VERTEXARRAY_HPP
 
 #include <algorithm>
+#include <cstdint>
 
+// stride is the padding after each element. A stepRate of 0 gives every vertex
+// its own element, and n gives every n instances of an instanced draw one
+// element, which the renderer points vertices at before each instance is
+// shaded.
 struct VertexArray
 {
-	VertexArray() = default;
-	VertexArray(size_t c, size_t s, void* v) : components(c), stride(s), vertices(v) {}
-	VertexArray(VertexArray const& va) : components(va.components), stride(va.stride), vertices(va.vertices) {}
-	VertexArray& operator=(VertexArray const& va) { components = va.components; stride = va.stride; vertices = va.vertices; return *this; };
-	VertexArray(VertexArray&& va) : components(std::move(va.components)), stride(std::move(va.stride)), vertices(std::move(va.vertices)) {}
+	VertexArray() : elementSize(sizeof(float)), components(0), stride(0), vertices(nullptr), stepRate(0) {}
+	VertexArray(size_t c, size_t s, void* v) : elementSize(sizeof(float)), components(c), stride(s), vertices(v), stepRate(0) {}
+	VertexArray(VertexArray const& va) : elementSize(va.elementSize), components(va.components), stride(va.stride), vertices(va.vertices), stepRate(va.stepRate) {}
+	VertexArray& operator=(VertexArray const& va) { elementSize = va.elementSize; components = va.components; stride = va.stride; vertices = va.vertices; stepRate = va.stepRate; return *this; };
+	VertexArray(VertexArray&& va) : elementSize(va.elementSize), components(std::move(va.components)), stride(std::move(va.stride)), vertices(std::move(va.vertices)), stepRate(va.stepRate) {}
 
+	// Per-instance arrays return the current instance's element for every
+	// vertex
 	void* index(size_t i) {
-		return (uint8_t*)(vertices) + (elementSize * components * i) + (stride * i);	
+		return (stepRate == 0) ? element(i) : vertices;
+	}
+
+	void* element(size_t i) {
+		return (uint8_t*)(vertices) + (elementSize * components * i) + (stride * i);
 	}
 
 	size_t elementSize;
 	size_t components;
 	size_t stride;
 	void* vertices;
+	size_t stepRate;
 };
 
-#endif // JHSR_VERTEXARRAY_HPP
\ No newline at end of file
+#endif // JHSR_VERTEXARRAY_HPP
@@ -0,0 +1,150 @@
+#ifndef JHSR_VERTEXCACHE_HPP
+#define JHSR_VERTEXCACHE_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+
+// Post-transform vertex cache keyed on vertex index. The cache maps each
+// vertex a draw references to a slot in the renderer's post-transform buffer,
+// which holds the shaded varyings along with the window space position
+// produced by process_vert. A miss allocates a new slot and queues the vertex
+// for shading, so a vertex shared by several triangles is only shaded once
+// while it stays resident.
+//
+// A non-zero size behaves like a hardware FIFO of that many entries. A size
+// of 0 caches the whole batch: every vertex in the index range passed to
+// begin_batch is shaded at most once per draw.
+class VertexCache
+{
+public:
+
+	VertexCache();
+
+	void set_size(size_t numEntries);
+
+	size_t size() const;
+
+	// Invalidates every entry. [first, last] bounds the vertex indices that
+	// will be looked up before the next call, and is only used for batch caching.
+	void begin_batch(size_t first, size_t last);
+
+	// Returns the post-transform slot for vindex.
+	uint32_t lookup(size_t vindex);
+
+	// Vertex indices that missed since begin_batch, in slot order.
+	std::vector< size_t > const& shade_list() const;
+
+	size_t hits() const;
+
+	size_t misses() const;
+
+	void reset_stats();
+
+private:
+
+	struct Entry
+	{
+		size_t vindex;
+		uint32_t slot;
+	};
+
+	uint32_t miss(size_t vindex);
+
+	size_t _size;
+	size_t _count;
+	size_t _next;
+	std::vector< Entry > _entries;
+
+	size_t _first;
+	std::vector< int32_t > _slots;
+
+	std::vector< size_t > _shadeList;
+	size_t _hits, _misses;
+};
+
+
+inline VertexCache::VertexCache()
+: _size(32), _count(0), _next(0), _first(0), _hits(0), _misses(0) {
+
+}
+
+inline void VertexCache::set_size(size_t numEntries) {
+	_size = numEntries;
+	_entries.clear();
+	_slots.clear();
+	_count = 0;
+	_next = 0;
+}
+
+inline size_t VertexCache::size() const {
+	return _size;
+}
+
+inline void VertexCache::begin_batch(size_t first, size_t last) {
+	_count = 0;
+	_next = 0;
+	_shadeList.clear();
+	if (_size == 0) {
+		assert(first <= last);
+		_first = first;
+		_slots.assign(last - first + 1, -1);
+	}
+	else {
+		_entries.resize(_size);
+	}
+}
+
+inline uint32_t VertexCache::miss(size_t vindex) {
+	++_misses;
+	_shadeList.push_back(vindex);
+	return uint32_t(_shadeList.size() - 1);
+}
+
+inline uint32_t VertexCache::lookup(size_t vindex) {
+	if (_size == 0) {
+		assert(vindex >= _first && vindex - _first < _slots.size());
+		int32_t& slot = _slots[vindex - _first];
+		if (slot >= 0) {
+			++_hits;
+			return uint32_t(slot);
+		}
+
+		slot = int32_t(miss(vindex));
+		return uint32_t(slot);
+	}
+
+	for (size_t i = 0; i < _count; ++i) {
+		if (_entries[i].vindex == vindex) {
+			++_hits;
+			return _entries[i].slot;
+		}
+	}
+
+	Entry& entry = _entries[_next];
+	_next = (_next + 1) % _size;
+	_count = std::min(_count + 1, _size);
+	entry.vindex = vindex;
+	entry.slot = miss(vindex);
+	return entry.slot;
+}
+
+inline std::vector< size_t > const& VertexCache::shade_list() const {
+	return _shadeList;
+}
+
+inline size_t VertexCache::hits() const {
+	return _hits;
+}
+
+inline size_t VertexCache::misses() const {
+	return _misses;
+}
+
+inline void VertexCache::reset_stats() {
+	_hits = 0;
+	_misses = 0;
+}
+
+#endif // JHSR_VERTEXCACHE_HPP
@@ -0,0 +1,250 @@
+// Headless check that rasterisation is watertight and free of overflow at
+// the largest supported target. Meshes whose triangles share every interior
+// edge are drawn over a square target with additive blending, so that each
+// pixel ends up counting the triangles that covered it, and every pixel
+// must count exactly one. That is checked for each rasteriser the CPU has,
+// at the coarsest and finest subpixel precision, for:
+//
+//   fan   a fan around an off grid point whose rim lies far outside the
+//         target, so every triangle is clipped against the guard band
+//   grid  a jittered grid of cells whose borders lie just outside the target
+//
+// Before that, a triangle reaching far past the guard band must be clipped on
+// the renderer's first draw and on the first draw after a viewport change,
+// since the snapped coordinates are only bounded for what the clipper lets
+// through.
+//
+//   watertight-check [--size N] [--threads N]
+//
+// --size defaults to Renderer::MAX_FRAMEBUFFER_SIZE, where the colour and
+// depth buffers take about 2 GB between them.
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Renderer.hpp"
+#include "SimdRasteriser.hpp"
+
+struct Mesh {
+    char const* name;
+    std::vector< glm::vec2 > positions;
+    std::vector< int32_t > indices;
+};
+
+// Deterministic jitter in [-1, 1)
+float jitter(uint32_t& state) {
+    state = (state * 1664525u) + 1013904223u;
+    return (float(state >> 8) / float(1 << 23)) - 1.0f;
+}
+
+Mesh build_fan(float size) {
+    enum { RIM = 997 };
+    Mesh mesh;
+    mesh.name = "fan";
+    mesh.positions.push_back(glm::vec2((size * 0.37f) + 0.3f, (size * 0.61f) + 0.7f));
+    uint32_t state = 1;
+    for (int i = 0; i < RIM; ++i) {
+        float angle = (float(i) + (0.4f * jitter(state))) * (6.2831853f / RIM);
+        float radius = size * (1.5f + (0.2f * jitter(state)));
+        mesh.positions.push_back(mesh.positions[0] + (radius * glm::vec2(std::cos(angle), std::sin(angle))));
+    }
+
+    for (int i = 0; i < RIM; ++i) {
+        mesh.indices.push_back(0);
+        mesh.indices.push_back(1 + i);
+        mesh.indices.push_back(1 + ((i + 1) % RIM));
+    }
+
+    return mesh;
+}
+
+// Vertices inside the grid move by up to 0.2 of a cell, which keeps every
+// cell convex so that neither of its triangles folds over the other. Those
+// on its border stay put so that the border stays outside the target.
+Mesh build_grid(float size) {
+    enum { CELLS = 61 };
+    Mesh mesh;
+    mesh.name = "grid";
+    float pad = 3.0f, cell = (size + (2.0f * pad)) / CELLS;
+    uint32_t state = 7;
+    for (int j = 0; j <= CELLS; ++j) {
+        for (int i = 0; i <= CELLS; ++i) {
+            glm::vec2 p(float(i) * cell - pad, float(j) * cell - pad);
+            if (i > 0 && i < CELLS && j > 0 && j < CELLS) {
+                p.x += 0.2f * cell * jitter(state);
+                p.y += 0.2f * cell * jitter(state);
+            }
+
+            mesh.positions.push_back(p);
+        }
+    }
+
+    for (int j = 0; j < CELLS; ++j) {
+        for (int i = 0; i < CELLS; ++i) {
+            int32_t v00 = (j * (CELLS + 1)) + i, v10 = v00 + 1, v01 = v00 + CELLS + 1, v11 = v01 + 1;
+            bool flip = ((i + j) % 2) == 1;
+            int32_t const triangles[] = { v00, v10, flip ? v01 : v11, flip ? v10 : v00, v11, v01 };
+            mesh.indices.insert(mesh.indices.end(), triangles, triangles + 6);
+        }
+    }
+
+    return mesh;
+}
+
+// Positions are in pixels, uniforms[0].f being the target's size
+VaryingData vsh_func(size_t vindex, VertexArray* attributes, std::vector< ShaderVariable > const& uniforms) {
+    glm::vec2 const& p = *reinterpret_cast< glm::vec2* >(attributes[0].index(vindex));
+    float scale = 2.0f / uniforms[0].f;
+    return VaryingData(1, glm::vec4((p.x * scale) - 1.0f, (p.y * scale) - 1.0f, 0.0f, 1.0f));
+}
+
+// One step of red per triangle covering the pixel
+glm::vec4 fsh_func(ShaderVariable* varyings, std::vector< ShaderVariable > const& uniforms) {
+    return glm::vec4(1.0f / 255.0f, 0.0f, 0.0f, 0.0f);
+}
+
+// Draws a triangle with a vertex at NDC (600, -1.5) on a fresh 4096 x 4096
+// target, on a 2 x 2 viewport, and on the 4096 x 4096 one again. The vertex
+// lies inside the guard band of the small viewport but far outside that of
+// the large one, so the first and last draws must clip the triangle.
+int check_guard_band(size_t numThreads) {
+    float const size = 4096.0f;
+    glm::vec2 const ndc[] = { glm::vec2(600.0f, -1.5f), glm::vec2(-0.5f, 0.5f), glm::vec2(0.5f, 0.8f) };
+    std::vector< glm::vec2 > positions;
+    for (glm::vec2 const& p : ndc) {
+        positions.push_back((p + 1.0f) * (0.5f * size));
+    }
+
+    Renderer renderer;
+    renderer.set_framebuffer(size_t(size), size_t(size), PixelFormat::RGBA8);
+    renderer.set_thread_count(numThreads);
+    renderer.set_cull_mode(CullMode::None);
+    renderer.set_subpixel_bits(Renderer::MAX_SUBPIXEL_BITS);
+    Shader vsh(vsh_func), fsh(fsh_func);
+    vsh.uniforms.push_back(size);
+    renderer.set_vertex_shader(vsh);
+    renderer.set_fragment_shader(fsh);
+    renderer.set_attribute(0, 2, 0, positions.data());
+    renderer.clear(glm::vec4(0.0f), INFINITY);
+
+    int failures = 0;
+    size_t const viewports[] = { size_t(size), 2, size_t(size) };
+    char const* const names[] = { "first draw", "small viewport", "viewport change" };
+    for (int i = 0; i < 3; ++i) {
+        renderer.set_viewport(0, 0, viewports[i], viewports[i]);
+        renderer.reset_clip_stats();
+        renderer.draw(0, 3);
+        ClipStats const& stats = renderer.clip_stats();
+        bool clip = (viewports[i] != 2);
+        std::printf("guard band %-16s: ", names[i]);
+        if (stats.trianglesClipped == (clip ? 1u : 0u) && stats.trianglesAccepted == (clip ? 0u : 1u)) {
+            std::printf("ok\n");
+        }
+        else {
+            std::printf("%llu accepted, %llu clipped, expected the triangle to be %s\n", (unsigned long long)stats.trianglesAccepted, (unsigned long long)stats.trianglesClipped, clip ? "clipped" : "accepted");
+            ++failures;
+        }
+    }
+
+    return failures;
+}
+
+int main(int argc, char** argv) {
+    size_t size = Renderer::MAX_FRAMEBUFFER_SIZE;
+    size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::fprintf(stderr, "unknown or incomplete option %s\n", arg.c_str());
+            return 2;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--size") size = size_t(std::atoi(value.c_str()));
+        else if (arg == "--threads") numThreads = std::max(1, std::atoi(value.c_str()));
+        else {
+            std::fprintf(stderr, "unknown option %s\n", arg.c_str());
+            return 2;
+        }
+    }
+
+    if (size == 0 || size > Renderer::MAX_FRAMEBUFFER_SIZE) {
+        std::fprintf(stderr, "size must be 1 to %d\n", int(Renderer::MAX_FRAMEBUFFER_SIZE));
+        return 2;
+    }
+
+    std::vector< std::pair< char const*, RasteriserFunc > > rasterisers;
+    rasterisers.push_back(std::make_pair("default", default_rasteriser));
+#if JHSR_X86_SIMD
+    rasterisers.push_back(std::make_pair("sse2", sse2_rasteriser));
+    if (best_rasteriser() == avx2_rasteriser) {
+        rasterisers.push_back(std::make_pair("avx2", avx2_rasteriser));
+    }
+#endif
+
+    int failures = check_guard_band(numThreads);
+    Renderer renderer;
+    renderer.set_framebuffer(size, size, PixelFormat::RGBA8);
+    renderer.set_viewport(0, 0, size, size);
+    renderer.set_thread_count(numThreads);
+    renderer.set_cull_mode(CullMode::None);
+    renderer.set_depth_test(DepthTest::Always);
+    renderer.set_depth_write(false);
+    BlendState blend;
+    blend.enabled = true;
+    blend.srcColor = blend.dstColor = blend.srcAlpha = blend.dstAlpha = BlendFactor::One;
+    renderer.set_blend_state(blend);
+
+    Shader vsh(vsh_func), fsh(fsh_func);
+    vsh.uniforms.push_back(float(size));
+    renderer.set_vertex_shader(vsh);
+    renderer.set_fragment_shader(fsh);
+
+    std::printf("%zux%zu target, %zu threads\n", size, size, numThreads);
+    Mesh const meshes[] = { build_fan(float(size)), build_grid(float(size)) };
+    for (Mesh const& mesh : meshes) {
+        renderer.set_attribute(0, 2, 0, const_cast< glm::vec2* >(mesh.positions.data()));
+        for (auto const& rasteriser : rasterisers) {
+            for (int bits : { int(Renderer::MIN_SUBPIXEL_BITS), int(Renderer::MAX_SUBPIXEL_BITS) }) {
+                renderer.set_rasteriser(rasteriser.second);
+                renderer.set_subpixel_bits(bits);
+                renderer.clear(glm::vec4(0.0f), INFINITY);
+                renderer.draw_indexed(0, mesh.indices.size(), const_cast< int32_t* >(mesh.indices.data()));
+                renderer.resolve();
+
+                // Red is the low byte of each pixel
+                uint32_t const* pixels = static_cast< uint32_t const* >(renderer.framebuffer().pixels());
+                size_t holes = 0, overlaps = 0, first = SIZE_MAX;
+                for (size_t i = 0; i < size * size; ++i) {
+                    uint32_t count = pixels[i] & 0xff;
+                    holes += (count == 0) ? 1 : 0;
+                    overlaps += (count > 1) ? 1 : 0;
+                    first = (count != 1) ? std::min(first, i) : first;
+                }
+
+                std::printf("%-5s %-8s %d bits: ", mesh.name, rasteriser.first, bits);
+                if (holes == 0 && overlaps == 0) {
+                    std::printf("ok\n");
+                }
+                else {
+                    std::printf("%zu pixels unwritten, %zu written more than once, first at (%zu, %zu)\n", holes, overlaps, first % size, first / size);
+                    ++failures;
+                }
+
+                std::fflush(stdout);
+            }
+        }
+    }
+
+    if (failures > 0) {
+        std::printf("%d failure%s\n", failures, (failures == 1) ? "" : "s");
+        return 1;
+    }
+
+    return 0;
+}
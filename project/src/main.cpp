@@ -7,15 +7,15 @@
 #include <tuple>
 #include "Renderer.hpp"
 #include "DefaultRasteriser.hpp"
+#include "Texture.hpp"
+#include "PLYLoader.hpp"
 #include "stb_image.h"
 
 Renderer renderer;
 GLuint read_fbo;
 GLuint framebuffer_tex;
-struct {
-    void* data;
-    int width, height, numChannels;
-} texture;
+Texture* texture = nullptr;
+Sampler sampler(TextureFilter::Trilinear, TextureWrap::Repeat);
 struct {
     std::vector< glm::vec3 > positions;
     std::vector< glm::vec2 > texcoords;
@@ -35,6 +35,57 @@ void CreateCylinder(float height, float radius, int subdiv, std::vector< glm::ve
     }
 }
 
+// A binary PLY model named on the command line is drawn instead of the
+// cylinder, with its positions read in place when the file allows it. Files
+// written by mesh-optimizer --strip are drawn as a strip.
+struct {
+    PLYLoader file;
+    VertexArray positions;
+    std::vector< glm::vec3 > converted;
+    std::vector< int32_t > indices;
+    PrimitiveTopology topology;
+    glm::vec3 center;
+    float scale;
+} model;
+
+bool load_model(char const* path) {
+    static char const* const xyz[] = { "x", "y", "z" };
+    if (!model.file.open(path) || model.file.vertex_count() == 0) {
+        std::printf("Can't load %s: %s\n", path, model.file.error().empty() ? "no vertices" : model.file.error().c_str());
+        return false;
+    }
+
+    if (!model.file.vertex_view("x", 3, model.positions)) {
+        model.converted.resize(model.file.vertex_count());
+        if (!model.file.read_vertices(xyz, 3, 0, model.converted.size(), &model.converted[0].x)) {
+            std::printf("Can't load %s: %s\n", path, model.file.error().c_str());
+            return false;
+        }
+
+        model.positions = VertexArray(3, 0, &model.converted[0].x);
+        model.positions.elementSize = sizeof(float);
+    }
+
+    bool strip = model.file.element("tristrips") != nullptr;
+    model.topology = strip ? PrimitiveTopology::TriangleStrip : PrimitiveTopology::TriangleList;
+    if (!(strip ? model.file.read_strips(model.indices) : model.file.read_faces(model.indices))) {
+        std::printf("Can't load %s: %s\n", path, model.file.error().c_str());
+        return false;
+    }
+
+    glm::vec3 lo(INFINITY), hi(-INFINITY);
+    for (size_t i = 0; i < model.file.vertex_count(); ++i) {
+        glm::vec3 const& position = *reinterpret_cast< glm::vec3* >(model.positions.index(i));
+        lo = glm::min(lo, position);
+        hi = glm::max(hi, position);
+    }
+
+    model.center = (lo + hi) * 0.5f;
+    model.scale = 2.0f / std::max(glm::length(hi - lo), 1e-6f);
+    std::printf("Loaded %s: %zu vertices, %zu indices\n", path, model.file.vertex_count(), model.indices.size());
+    return true;
+}
+
 enum : size_t
 {
 	WIDTH = 640,
@@ -80,20 +131,35 @@ VaryingData vsh_func(size_t vindex, VertexArray* attributes, std::vector< Shader
     return output;
 }
 
+// Set up with derivatives on, so varyings[1] and varyings[2] are the uv
+// derivatives
 glm::vec4 fsh_func(ShaderVariable* varyings, std::vector< ShaderVariable > const& uniforms) {
-    struct rgb8 { uint8_t r, g, b; };
-    glm::ivec2 st(varyings[0].v2.x * texture.width, varyings[0].v2.y * texture.height);
-    rgb8* pixels = reinterpret_cast< rgb8* >(texture.data);
-    size_t index = std::min((st.y * texture.width) + st.x, (texture.width * texture.height) - 1);
-    rgb8 pcolor = pixels[index];
-    return glm::vec4(pcolor.r / 255.0f, pcolor.g / 255.0f, pcolor.b / 255.0f, 255.0f);
+    return texture->sample(sampler, varyings[0].v2, varyings[1].v2, varyings[2].v2);
+}
+
+// Coloured by where the vertex is in the model's bounds
+VaryingData model_vsh(size_t vindex, VertexArray* attributes, std::vector< ShaderVariable > const& uniforms) {
+    auto& position = *reinterpret_cast< glm::vec3* >(attributes[0].index(vindex));
+    glm::mat4x4 const& modelview  = uniforms[0].m4;
+    glm::mat4x4 const& projection = uniforms[1].m4;
+
+    VaryingData output;
+    output.push_back(projection * modelview * glm::vec4(position.x, position.y, position.z, 1.0f));
+    output.push_back(glm::clamp(((position - model.center) * model.scale) + 0.5f, 0.0f, 1.0f));
+    return output;
+}
+
+glm::vec4 model_fsh(ShaderVariable* varyings, std::vector< ShaderVariable > const& uniforms) {
+    return glm::vec4(varyings[0].v3, 1.0f);
 }
 
 void init(void) {
-    texture.data = nullptr;
-    texture.data = stbi_load("Nehe.png", &texture.width, &texture.height, &texture.numChannels, 3);
-    std::printf("Num channels: %i\n", texture.numChannels);
-    assert(texture.data != nullptr);
+    int width, height, numChannels;
+    stbi_uc* data = stbi_load("Nehe.png", &width, &height, &numChannels, 3);
+    std::printf("Num channels: %i\n", numChannels);
+    assert(data != nullptr);
+    texture = new Texture(width, height, 3, data);
+    stbi_image_free(data);
 
     CreateCylinder(1.0f, 1.0f, 100, cylinder.positions, cylinder.texcoords);
 
@@ -126,6 +192,7 @@ void draw_quad() {
     auto modelview = glm::translate(glm::mat4x4(), glm::vec3(0.0f, 0.0f, -3.5f)) * glm::rotate(glm::mat4x4(), float(0.0f), glm::vec3(1.0f, 0.0f, 0.0f));
     auto projection = glm::perspective(60.0f, static_cast< float >(WIDTH) / static_cast< float >(HEIGHT), 0.1f, 100.0f);
     Shader vsh(vsh_func), fsh(fsh_func);
+    fsh.derivatives = true;
     vsh.uniforms.push_back(modelview);
     vsh.uniforms.push_back(projection);
 
@@ -146,6 +213,7 @@ void draw_cylinder() {
     auto modelview = glm::translate(glm::mat4x4(), glm::vec3(0.0f, 0.0f, -3.5f)) * glm::rotate(glm::mat4x4(), float(angle), glm::vec3(1.0f, 0.0f, 0.0f));
     auto projection = glm::perspective(60.0f, static_cast< float >(WIDTH) / static_cast< float >(HEIGHT), 0.1f, 100.0f);
     Shader vsh(vsh_func), fsh(fsh_func);
+    fsh.derivatives = true;
     vsh.uniforms.push_back(modelview);
     vsh.uniforms.push_back(projection);
 
@@ -153,9 +221,32 @@ void draw_cylinder() {
     renderer.set_fragment_shader(fsh);
     renderer.set_primitive_topology(PrimitiveTopology::TriangleStrip);
     renderer.set_polygon_winding(PolygonWinding::CounterClockwise);
+    // The open ends show the inside, so both faces are drawn
+    renderer.set_cull_mode(CullMode::None);
     renderer.draw(0, cylinder.positions.size());
-    renderer.set_polygon_winding(PolygonWinding::Clockwise);
-    renderer.draw(0, cylinder.positions.size());
+    renderer.set_cull_mode(CullMode::Back);
+}
+
+void draw_model() {
+    renderer.set_attribute(0, 3, model.positions.stride, model.positions.vertices);
+
+    static int angle = 0;
+    angle = (angle + 1) % 360;
+    auto modelview = glm::translate(glm::mat4x4(), glm::vec3(0.0f, 0.0f, -3.5f)) * glm::rotate(glm::mat4x4(), float(angle), glm::vec3(0.0f, 1.0f, 0.0f))
+                   * glm::scale(glm::mat4x4(), glm::vec3(model.scale)) * glm::translate(glm::mat4x4(), -model.center);
+    auto projection = glm::perspective(60.0f, static_cast< float >(WIDTH) / static_cast< float >(HEIGHT), 0.1f, 100.0f);
+    Shader vsh(model_vsh), fsh(model_fsh);
+    vsh.uniforms.push_back(modelview);
+    vsh.uniforms.push_back(projection);
+
+    renderer.set_vertex_shader(vsh);
+    renderer.set_fragment_shader(fsh);
+    renderer.set_primitive_topology(model.topology);
+    renderer.set_polygon_winding(PolygonWinding::CounterClockwise);
+    // Scans often have inconsistent winding
+    renderer.set_cull_mode(CullMode::None);
+    renderer.draw_indexed(0, model.indices.size(), model.indices.data());
+    renderer.set_cull_mode(CullMode::Back);
 }
 
 void draw() {
@@ -166,7 +257,12 @@ void draw() {
     framebuffer.clear(&clearColor);
 
     //draw_quad();
-    draw_cylinder();
+    if (model.indices.empty()) {
+        draw_cylinder();
+    }
+    else {
+        draw_model();
+    }
 
     glBindTexture(GL_TEXTURE_2D, framebuffer_tex);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, framebuffer.width(), framebuffer.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, framebuffer.pixels());
@@ -203,6 +299,10 @@ void idle(void) {
 
 int main(int argc, char** argv) {
     glutInit(&argc, argv);
+    if (argc > 1 && !load_model(argv[1])) {
+        return 1;
+    }
+
     glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE);
     glutInitWindowSize(WIDTH, HEIGHT);
     glutCreateWindow("GLUT Program");